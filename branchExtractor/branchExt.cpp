@@ -36,15 +36,34 @@ END_LEGAL */
     This code extracts the number of instruction executed by the processors and logs
     the branches. It produces two log files name `generalInfo.out` consisting
     information about the total number of instuctions and `branches.out`(default)
-    consisting following information:
-    BRANCH_TARGET `S` `K` `C` BRANCH_ADDR # BASE ??????
-    where `S` can be `1`(Taken) or `0`(Not taken) and `K` can be `1`(Conditional) or
-    `0`(Unconditional), and `C` can be `1`(Call ints.) or `0`(Not call instruction)
-    and ?????? is the disassembled instruction and its opcode.
+    consisting of a compact binary entry per branch (see branchTrace.h): the
+    ID of the static branch, its outcome and, for indirect branches only,
+    its target, along with the number of instructions since the previous
+    branch. Each static branch is defined once per trace, with its PC,
+    static target, type and, with -disasm, its disassembly.
+    Branches are collected in per-thread Pin trace buffers and handed, when a
+    buffer fills up, to an internal writer thread that streams them through
+    bzip2 or zstd (-z) into `branches.out.bz2`; trace2txt converts the entries
+    into the text format read by the simulator. Every application thread has
+    its own trace and counters: the main thread writes `branches_<set>.out`,
+    thread N writes `branches_tN_<set>.out`.
+
+    Recording starts after the first `f` instructions, or, when a region of
+    interest is given, only inside it: between the entry and the exit of a
+    routine (-roi_rtn, from its -roi_count-th call) or between two SSC
+    marker instructions (-roi_marker_start/-roi_marker_stop). Outside the
+    region no instrumentation is left in the program but the triggers.
+    For very long programs -sample_period records a sample of
+    -sample_warmup + -sample_size instructions every period instead, with
+    the sample boundaries written into the trace, and only counts
+    instructions in between.
+    With -predict no trace is written at all: the drained buffers are fed
+    straight to the simulator's predictor (src/predictor.cpp), configured
+    with the simulator's options, and its statistics are printed at exit.
 */
 
 // T = 1, C = 1      ,  Call = 0      ,  Ret = 0   ,  Direct = 1
-// (T-N), (Con-Uncon), (Call-NotCall), (Ret-NotRet), (Direct-NotDirect), (first_inst_count_after_offset)
+// (T-N), (Con-Uncon), (Call-NotCall), (Ret-NotRet), (Direct-NotDirect)
 
 #include <stdlib.h>
 #include <cstdio>
@@ -55,8 +74,15 @@ END_LEGAL */
 #include <fstream>
 #include <cstdlib>
 #include <map>
+#include <vector>
+#include <stddef.h>
 #include "pin.H"
 #include "instlib.H"
+#include "branchTrace.h"
+// The Pin CRT defines STATIC, which the predictor uses for its static scheme
+#undef STATIC
+#include "predictor.h"
+#include "simulate.h"
 
 using namespace std;
 
@@ -67,26 +93,47 @@ static ADDRINT dl_debug_state_Addr = 0;
 static ADDRINT dl_debug_state_AddrEnd = 0;
 static BOOL justFoundDlDebugState = FALSE;
 
-ofstream OutFile;
-ofstream axuFile;
-// The running count of instructions is kept here
-// make it static to help the compiler optimize docount
-static UINT64 icount = 0;
-static UINT64 cbcount = 0;
-static UINT64 ubcount = 0;
-static UINT64 callcount = 0;
-static UINT64 retcount = 0;
 static int64_t howManyBranch = 0;
 static UINT64 howManySet = 0;
-static UINT64 fileCounter = 0;
 static UINT64 offset_inst = 0;
-static UINT64 first_inst_count_after_offset = 0;
-static bool first_record = true;
 static bool record = false;
-static ostringstream filePrefix;
+
+// Region of interest triggers; recording is switched on and off for all
+// threads at once under regionLock
+static PIN_LOCK regionLock;
+static string roiRtn;
+static UINT64 roiCount = 1;
+static UINT64 roiCalls = 0;
+static UINT64 roiDepth = 0;
+static INT64 roiMarkerStart = -1;
+static INT64 roiMarkerStop = -1;
+
+// Sampling: a sample of sampleWarmup + sampleSize instructions is recorded
+// every samplePeriod instructions from the offset on; 0 disables it
+static UINT64 samplePeriod = 0;
+static UINT64 sampleWarmup = 0;
+static UINT64 sampleSize = 0;
+// Threads inside a sample, under regionLock
+static UINT32 samplingThreads = 0;
+
+static bool recordDisassembly = false;
+
+// Online evaluation: branches are simulated instead of written. The
+// predictor and its statistics are shared by all threads, each keeping its
+// own SampleState; predictLock is held, together with staticLock, while a
+// buffer is simulated
+static bool online = false;
+static PIN_LOCK predictLock;
 
 static UINT64 CBCOUNT_LIMIT = 10000000;
-static UINT64 prev_cbcount = -1;
+
+// Pages in each per-thread trace buffer
+#define NUM_BUF_PAGES 64
+static BUFFER_ID bufId;
+// Per-thread running count of instructions, stored with each branch
+static REG icountReg;
+// Per-thread instruction count of the next sample boundary
+static REG switchReg;
 
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "branches", "specifies the output file name prefix.");
 
@@ -97,106 +144,630 @@ KNOB<string> KnobHowManyBranch(KNOB_MODE_WRITEONCE, "pintool", "m", "-1", "Speci
 KNOB<string> KnobOffset(KNOB_MODE_WRITEONCE, "pintool", "f", "20000000", "Starts saving instructions after seeing the first `f` instruction.");
 // KNOB<string> KnobOffset(KNOB_MODE_WRITEONCE, "pintool", "f", "0", "Starts saving instructions after seeing the first `f` instruction.");
 
-VOID write_on_axu()
+KNOB<string> KnobRoiRtn(KNOB_MODE_WRITEONCE, "pintool", "roi_rtn", "", "Records only while inside the routine with this symbol name.");
+
+KNOB<string> KnobRoiCount(KNOB_MODE_WRITEONCE, "pintool", "roi_count", "1", "Starts recording at this call of the -roi_rtn routine.");
+
+KNOB<string> KnobRoiMarkerStart(KNOB_MODE_WRITEONCE, "pintool", "roi_marker_start", "-1", "Starts recording at the SSC marker with this id.");
+
+KNOB<string> KnobRoiMarkerStop(KNOB_MODE_WRITEONCE, "pintool", "roi_marker_stop", "-1", "Stops recording at the SSC marker with this id.");
+
+KNOB<string> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool", "sample_period", "0", "Records a sample every this many instructions. 0 records everything.");
+
+KNOB<string> KnobSampleWarmup(KNOB_MODE_WRITEONCE, "pintool", "sample_warmup", "1000000", "Instructions at the start of a sample that only warm up the predictor.");
+
+KNOB<string> KnobSampleSize(KNOB_MODE_WRITEONCE, "pintool", "sample_size", "1000000", "Instructions measured in a sample, after its warmup.");
+
+KNOB<string> KnobCompress(KNOB_MODE_WRITEONCE, "pintool", "z", "bzip2", "Compresses the trace while it is written: none, bzip2 or zstd.");
+
+KNOB<string> KnobPredict(KNOB_MODE_WRITEONCE, "pintool", "predict", "", "Simulates the predictor given by these simulator options, e.g. \"--gshare --btb\", instead of writing a trace.");
+
+KNOB<string> KnobDisassembly(KNOB_MODE_WRITEONCE, "pintool", "disasm", "0", "Records the disassembly of every static branch in the trace when 1.");
+
+/************
+ *
+ * Trace writer
+ *
+ */
+
+// Drained records are staged and handed to an internal writer thread a
+// chunk at a time, so the application threads never wait on the file or
+// the compressor unless the queue is full
+#define WRITE_CHUNK_BYTES (128 * 1024)
+#define WRITE_QUEUE_CHUNKS 16
+
+struct WRITE_CHUNK
+{
+    FILE *file;  // NULL stops the writer thread
+    UINT32 size; // 0 closes the file
+    char data[WRITE_CHUNK_BYTES];
+};
+
+static WRITE_CHUNK writeQueue[WRITE_QUEUE_CHUNKS];
+static UINT32 writeHead = 0;
+static UINT32 writeCount = 0;
+static PIN_MUTEX writeMutex;
+static PIN_SEMAPHORE writeNotEmpty;
+static PIN_SEMAPHORE writeNotFull;
+static PIN_SEMAPHORE writerExited;
+static PIN_THREAD_UID writerUid;
+static BOOL writerRunning = FALSE;
+
+// Open a trace file, piped through the compressor selected with -z
+static FILE *trace_open(const string &name)
 {
-    axuFile << "!!! Number of Instructions = " << (icount - offset_inst - ((fileCounter - 1) * howManyBranch) + 1) << endl;
-    axuFile << "!!! Number of Unconditional branches = " << ubcount << endl;
-    axuFile << "!!! Number of Conditional branches = " << cbcount << endl;
-    axuFile << "!!! Number of Call branches = " << callcount << endl;
-    axuFile << "!!! Number of Ret branches = " << retcount << endl;
+    FILE *file;
+    if (KnobCompress.Value() == "bzip2")
+        file = popen(("bzip2 -c > '" + name + ".bz2'").c_str(), "w");
+    else if (KnobCompress.Value() == "zstd")
+        file = popen(("zstd -q -c > '" + name + ".zst'").c_str(), "w");
+    else
+        file = fopen(name.c_str(), "wb");
 
-    axuFile.close();
+    if (file == NULL)
+    {
+        cerr << "Error: could not open " << name << endl;
+        exit(1);
+    }
+
+    // Written before any chunk for the file can be queued
+    BRANCH_TRACE_HEADER header;
+    memcpy(header.magic, BRANCH_TRACE_MAGIC, sizeof(header.magic));
+    header.version = BRANCH_TRACE_VERSION;
+    fwrite(&header, sizeof(header), 1, file);
+    return file;
 }
 
-VOID Fini(INT32 code, VOID *v)
+static VOID trace_perform(FILE *file, const VOID *data, UINT32 size)
 {
-    // Write to a file since cout and cerr maybe closed by the application
-    cout << "Logging data..." << endl;
-    write_on_axu();
-    OutFile.close();
+    if (size > 0)
+        fwrite(data, 1, size, file);
+    else if (KnobCompress.Value() == "none")
+        fclose(file);
+    else
+        pclose(file);
+}
+
+// Write 'size' bytes to 'file', or close it when 'size' is 0; queued for
+// the writer thread while it runs. A NULL file stops the writer thread.
+static VOID trace_submit(FILE *file, const VOID *data, UINT32 size)
+{
+    PIN_MutexLock(&writeMutex);
+    while (writerRunning && writeCount == WRITE_QUEUE_CHUNKS)
+    {
+        PIN_SemaphoreClear(&writeNotFull);
+        PIN_MutexUnlock(&writeMutex);
+        PIN_SemaphoreWait(&writeNotFull);
+        PIN_MutexLock(&writeMutex);
+    }
+
+    if (!writerRunning)
+    {
+        // Let the writer finish what is queued before writing behind it
+        PIN_MutexUnlock(&writeMutex);
+        PIN_SemaphoreWait(&writerExited);
+        if (file != NULL)
+            trace_perform(file, data, size);
+        return;
+    }
+
+    // Filled under the lock so the writer takes the chunks of all threads
+    // in the order they were queued
+    WRITE_CHUNK *chunk = &writeQueue[(writeHead + writeCount) % WRITE_QUEUE_CHUNKS];
+    chunk->file = file;
+    chunk->size = size;
+    if (size > 0)
+        memcpy(chunk->data, data, size);
+    writeCount++;
+    if (file == NULL)
+        writerRunning = FALSE;
+    PIN_SemaphoreSet(&writeNotEmpty);
+    PIN_MutexUnlock(&writeMutex);
 }
 
-VOID reset_var()
+static VOID WriterThread(VOID *arg)
 {
-    cbcount = 0;
-    ubcount = 0;
-    callcount = 0;
-    retcount = 0;
-    first_inst_count_after_offset = 0;
+    for (;;)
+    {
+        PIN_MutexLock(&writeMutex);
+        while (writeCount == 0)
+        {
+            PIN_SemaphoreClear(&writeNotEmpty);
+            PIN_MutexUnlock(&writeMutex);
+            PIN_SemaphoreWait(&writeNotEmpty);
+            PIN_MutexLock(&writeMutex);
+        }
+        WRITE_CHUNK *chunk = &writeQueue[writeHead];
+        PIN_MutexUnlock(&writeMutex);
+
+        if (chunk->file == NULL)
+            break;
+        trace_perform(chunk->file, chunk->data, chunk->size);
+
+        PIN_MutexLock(&writeMutex);
+        writeHead = (writeHead + 1) % WRITE_QUEUE_CHUNKS;
+        writeCount--;
+        PIN_SemaphoreSet(&writeNotFull);
+        PIN_MutexUnlock(&writeMutex);
+    }
+    PIN_SemaphoreSet(&writerExited);
 }
 
-UINT32 file_init()
+// Let the writer thread finish the queue and exit; later writes are done
+// by the thread that submits them
+static VOID StopWriter()
 {
-    cout << "Writing " << fileCounter - 1 << endl;
+    if (!writerRunning)
+        return;
+    trace_submit(NULL, NULL, 0);
+    PIN_WaitForThreadTermination(writerUid, PIN_INFINITE_TIMEOUT, NULL);
+}
 
-    write_on_axu();
+/************
+ *
+ * Static branch table
+ *
+ */
 
-    OutFile.close();
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << KnobOutputFile.Value() << "_" << fileCounter << ".out";
-    OutFile.open(filePrefix.str().c_str());
-    OutFile.setf(ios::showbase);
+// A branch as known at instrumentation time; its index is the ID under
+// which the traces refer to it
+struct STATIC_BRANCH
+{
+    ADDRINT pc;
+    ADDRINT target; // 0 unless BT_DIRECT
+    UINT8 flags;
+};
 
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << axuliryFileName << "_" << fileCounter << ".out";
-    axuFile.open(filePrefix.str().c_str());
-    axuFile.setf(ios::showbase);
+// Written while instrumenting, read as traces define the branches
+static PIN_LOCK staticLock;
+static vector<STATIC_BRANCH> staticBranches;
+static map<ADDRINT, UINT32> branchIds;
 
-    reset_var();
+// ID of the static branch 'ins'; a branch instrumented again, after the
+// instrumentation is removed or its trace is evicted, keeps its ID
+static UINT32 branch_id(INS ins, UINT8 flags)
+{
+    STATIC_BRANCH branch;
+    branch.pc = INS_Address(ins);
+    branch.target = (flags & BT_DIRECT) ? INS_DirectControlFlowTargetAddress(ins) : 0;
+    branch.flags = flags;
 
-    return 0;
+    PIN_GetLock(&staticLock, PIN_ThreadId() + 1);
+    map<ADDRINT, UINT32>::iterator it = branchIds.find(branch.pc);
+    if (it == branchIds.end() || staticBranches[it->second].target != branch.target ||
+        staticBranches[it->second].flags != branch.flags)
+    {
+        // New, or new code at the address of an old branch
+        branchIds[branch.pc] = staticBranches.size();
+        staticBranches.push_back(branch);
+        if (recordDisassembly)
+            disAssemblyMap[branch.pc] = INS_Disassemble(ins);
+        it = branchIds.find(branch.pc);
+    }
+    UINT32 id = it->second;
+    PIN_ReleaseLock(&staticLock);
+    return id;
+}
+
+/************
+ *
+ * Per-thread trace streams
+ *
+ */
+
+// Everything an application thread records into, kept in its TLS slot so
+// that threads share neither a stream nor a counter
+struct THREAD_DATA
+{
+    THREADID tid;
+    FILE *outFile;
+    ofstream axuFile;
+    // The running count of instructions is kept in icountReg; this copy is
+    // brought up to date as the trace buffer drains and at thread exit
+    UINT64 icount;
+    UINT64 lastIcount; // Count at the previous branch of the trace
+    UINT64 cbcount;
+    UINT64 ubcount;
+    UINT64 callcount;
+    UINT64 retcount;
+    UINT64 fileCounter;
+    BOOL done; // Past the last set or CBCOUNT_LIMIT, further records are dropped
+    // Sample the records being written belong to, and whether the thread's
+    // own count is inside a sample as far as the instrumentation is concerned
+    UINT32 samplePhase;
+    UINT64 sampleStart;
+    UINT64 numSamples;
+    BOOL inSample;
+    SampleState sampleState; // Where -predict is in the thread's samples
+    vector<bool> defined; // Static branches defined in the current trace
+    UINT32 numStaged;     // Bytes
+    UINT8 staged[WRITE_CHUNK_BYTES];
+};
+
+// Phases of the sampling schedule
+enum
+{
+    PHASE_OUT = 0,
+    PHASE_WARMUP,
+    PHASE_MEASURE
+};
+
+static TLS_KEY threadDataKey;
+// Protects the thread counts below
+static PIN_LOCK threadLock;
+static UINT32 liveThreads = 0;
+static UINT32 doneThreads = 0;
+
+// Name of a file of set 'set' of thread 'tid'; the main thread keeps the
+// names of a single-threaded run
+static string thread_file_name(const string &prefix, THREADID tid, UINT64 set)
+{
+    ostringstream name;
+    name << prefix;
+    if (tid > 0)
+        name << "_t" << tid;
+    name << "_" << set << ".out";
+    return name.str();
 }
 
-// This function is called before every instruction is executed
-VOID docount()
+static VOID flush_staged(THREAD_DATA *td)
 {
-    // cerr<< "I:" << icount << "V:" << (howManyBranch+ offset_inst - 1) << (!((icount) % (howManyBranch+ offset_inst - 1))? "Tr":"Fa") << endl;
-    if (howManyBranch > 0)
+    if (td->numStaged > 0)
     {
-        if (!((icount) % ((howManyBranch * (fileCounter + 1)) + offset_inst - 1)) && icount > 0)
-        {
-            fileCounter++;
-            if (fileCounter > howManySet - 1)
-            {
-                cout << "Exiting because of user conditions" << endl;
-                Fini(0, 0);
-                exit(0);
-            }
-            else
-            {
-                file_init();
-            }
-        }
+        trace_submit(td->outFile, td->staged, td->numStaged);
+        td->numStaged = 0;
     }
+}
 
-    icount++;
+// Room for the next entry
+static UINT8 *stage_entry(THREAD_DATA *td)
+{
+    if (td->numStaged + BT_MAX_ENTRY_BYTES > WRITE_CHUNK_BYTES)
+        flush_staged(td);
+    return td->staged + td->numStaged;
+}
 
-    if (cbcount != prev_cbcount && cbcount % 10000 == 0)
-        cout << icount << " "<< cbcount << endl;
-    prev_cbcount = cbcount;
+static UINT8 *put_u64(UINT8 *p, UINT64 value)
+{
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
 
-    if (cbcount >= CBCOUNT_LIMIT)
+static VOID stage_sample(THREAD_DATA *td, UINT32 kind, UINT64 count, UINT64 weight)
+{
+    if (online)
     {
-        fileCounter++;
-        cout << "Exiting because of CBCOUNT_LIMIT" << endl;
-        Fini(0, 0);
-        exit(0);
+        sample_boundary(&td->sampleState, kind, count, weight);
+        return;
     }
 
-    if (icount >= offset_inst && fileCounter == 0)
+    UINT8 *p = stage_entry(td);
+    UINT8 *q = p + bt_put_varint(p, ((UINT64)kind << BT_ENTRY_TAG_BITS) | BT_ENTRY_SAMPLE);
+    q = put_u64(q, count);
+    q = put_u64(q, weight);
+    td->numStaged += q - p;
+}
+
+static VOID stage_define(THREAD_DATA *td, UINT32 id)
+{
+    PIN_GetLock(&staticLock, td->tid + 1);
+    STATIC_BRANCH branch = staticBranches[id];
+    string disassembly;
+    if (recordDisassembly)
+        disassembly = disAssemblyMap[branch.pc].substr(0, BT_MAX_DISASSEMBLY);
+    PIN_ReleaseLock(&staticLock);
+
+    UINT8 *p = stage_entry(td);
+    UINT8 *q = p + bt_put_varint(p, ((UINT64)id << BT_ENTRY_TAG_BITS) | BT_ENTRY_DEFINE);
+    q = put_u64(q, branch.pc);
+    q = put_u64(q, branch.target);
+    *q++ = branch.flags;
+    q += bt_put_varint(q, disassembly.size());
+    memcpy(q, disassembly.data(), disassembly.size());
+    q += disassembly.size();
+    td->numStaged += q - p;
+
+    if (id >= td->defined.size())
+        td->defined.resize(id + 1);
+    td->defined[id] = true;
+}
+
+static VOID stage_branch(THREAD_DATA *td, UINT32 id, UINT32 flags, BOOL taken, UINT64 target, UINT64 icount)
+{
+    UINT64 distance = icount > td->lastIcount ? icount - td->lastIcount : 0;
+    td->lastIcount = icount;
+
+    if (online)
+    {
+        const STATIC_BRANCH &branch = staticBranches[id];
+        simulate_branch(&td->sampleState, branch.pc, (flags & BT_DIRECT) ? branch.target : target,
+                        taken ? TAKEN : NOTTAKEN, !!(flags & BT_CONDITIONAL), !!(flags & BT_CALL),
+                        !!(flags & BT_RET), !!(flags & BT_DIRECT), distance);
+        return;
+    }
+
+    if (id >= td->defined.size() || !td->defined[id])
+        stage_define(td, id);
+
+    UINT8 *p = stage_entry(td);
+    UINT8 *q = p + bt_put_varint(p, ((UINT64)id << BT_ENTRY_TAG_BITS) | (taken ? BT_ENTRY_TAKEN : BT_ENTRY_NOT_TAKEN));
+    q += bt_put_varint(q, distance);
+    if (!(flags & BT_DIRECT))
+        q = put_u64(q, target);
+    td->numStaged += q - p;
+}
+
+// Hold the predictor and the static branch table while the thread's
+// branches are simulated; nothing to do when writing a trace
+static VOID predict_lock(THREAD_DATA *td)
+{
+    if (online)
     {
-        // cout << "Here!" << endl;
-        first_inst_count_after_offset++; // Although here is going to be increased by one, it will be set to 1 whenever it reaches to fist branch;
-        record = true;
+        PIN_GetLock(&predictLock, td->tid + 1);
+        PIN_GetLock(&staticLock, td->tid + 1);
     }
-    else if (fileCounter > 0)
+}
+
+static VOID predict_unlock(THREAD_DATA *td)
+{
+    if (online)
     {
-        first_inst_count_after_offset++;
+        PIN_ReleaseLock(&staticLock);
+        PIN_ReleaseLock(&predictLock);
     }
 }
 
+// Phase of instruction count 'count' in the sampling schedule, and the
+// start of the sample period it falls in
+static UINT32 sample_phase(UINT64 count, UINT64 *start)
+{
+    *start = 0;
+    if (count <= offset_inst)
+        return PHASE_OUT;
+
+    *start = offset_inst + (count - offset_inst - 1) / samplePeriod * samplePeriod;
+    UINT64 pos = count - *start;
+    if (pos <= sampleWarmup)
+        return PHASE_WARMUP;
+    if (pos <= sampleWarmup + sampleSize)
+        return PHASE_MEASURE;
+    return PHASE_OUT;
+}
+
+// Write the sample boundaries passed up to instruction count 'count';
+// returns whether a branch there belongs to a sample
+static BOOL sample_advance(THREAD_DATA *td, UINT64 count)
+{
+    UINT64 start;
+    UINT32 phase = sample_phase(count, &start);
+
+    if (td->samplePhase != PHASE_OUT && (phase == PHASE_OUT || start != td->sampleStart))
+    {
+        stage_sample(td, BT_SAMPLE_END, td->sampleStart + sampleWarmup + sampleSize, 0);
+        td->samplePhase = PHASE_OUT;
+    }
+    if (phase == PHASE_OUT)
+        return FALSE;
+
+    if (td->samplePhase == PHASE_OUT)
+    {
+        stage_sample(td, BT_SAMPLE_WARMUP, start, samplePeriod);
+        td->lastIcount = start;
+        td->samplePhase = PHASE_WARMUP;
+        td->sampleStart = start;
+        td->numSamples++;
+    }
+    if (phase == PHASE_MEASURE && td->samplePhase == PHASE_WARMUP)
+    {
+        stage_sample(td, BT_SAMPLE_MEASURE, start + sampleWarmup, 0);
+        td->samplePhase = PHASE_MEASURE;
+    }
+    return TRUE;
+}
+
+VOID write_on_axu(THREAD_DATA *td)
+{
+    // A thread that ends before the offset has recorded no instructions
+    UINT64 instructions = 0;
+    if (td->icount > offset_inst)
+        instructions = td->icount - offset_inst - ((td->fileCounter - 1) * howManyBranch) + 1;
+    td->axuFile << "!!! Number of Instructions = " << instructions << endl;
+    td->axuFile << "!!! Number of Unconditional branches = " << td->ubcount << endl;
+    td->axuFile << "!!! Number of Conditional branches = " << td->cbcount << endl;
+    td->axuFile << "!!! Number of Call branches = " << td->callcount << endl;
+    td->axuFile << "!!! Number of Ret branches = " << td->retcount << endl;
+    if (samplePeriod > 0)
+        td->axuFile << "!!! Number of Samples = " << td->numSamples << endl;
+
+    td->axuFile.close();
+}
+
+VOID reset_var(THREAD_DATA *td)
+{
+    td->cbcount = 0;
+    td->ubcount = 0;
+    td->callcount = 0;
+    td->retcount = 0;
+}
+
+// Open the trace and generalInfo files of the thread's current set
+VOID open_files(THREAD_DATA *td)
+{
+    td->outFile = online ? NULL : trace_open(thread_file_name(KnobOutputFile.Value(), td->tid, td->fileCounter));
+    td->defined.clear();
+    // No record at or before the thread's offset is kept (see BufferFull),
+    // so the first branch of a trace counts its distance from the offset,
+    // or from where the set starts, and is never 0
+    td->lastIcount = td->icount > offset_inst ? td->icount : offset_inst;
+    td->axuFile.open(thread_file_name(axuliryFileName, td->tid, td->fileCounter).c_str());
+    td->axuFile.setf(ios::showbase);
+}
+
+VOID close_files(THREAD_DATA *td)
+{
+    // A sample cut short by the end of the thread ends where it stopped
+    if (td->samplePhase != PHASE_OUT)
+    {
+        UINT64 end = td->sampleStart + sampleWarmup + sampleSize;
+        predict_lock(td);
+        stage_sample(td, BT_SAMPLE_END, td->icount < end ? td->icount : end, 0);
+        predict_unlock(td);
+        td->samplePhase = PHASE_OUT;
+    }
+
+    write_on_axu(td);
+    if (td->outFile != NULL)
+    {
+        flush_staged(td);
+        trace_submit(td->outFile, NULL, 0);
+        td->outFile = NULL;
+    }
+}
+
+UINT32 file_init(THREAD_DATA *td)
+{
+    cout << "Writing " << td->fileCounter - 1 << endl;
+
+    close_files(td);
+    open_files(td);
+    reset_var(td);
+
+    return 0;
+}
+
+// Stop recording the thread; returns whether every live thread has stopped
+static BOOL finish_thread(THREAD_DATA *td)
+{
+    close_files(td);
+    td->done = TRUE;
+
+    PIN_GetLock(&threadLock, td->tid + 1);
+    BOOL all = ++doneThreads == liveThreads;
+    PIN_ReleaseLock(&threadLock);
+    return all;
+}
+
+VOID Fini(INT32 code, VOID *v)
+{
+    // Every thread has closed its files in ThreadFini
+    cout << "Logging data..." << endl;
+
+    if (online)
+        print_statistics();
+}
+
+// This function is called at the start of every basic block with the
+// number of instructions in it, simple enough for Pin to inline
+ADDRINT docount(ADDRINT count, UINT32 numIns)
+{
+    return count + numIns;
+}
+
+// Checked at the start of every basic block until recording starts; set
+// rollover and the branch limit are checked as the trace buffer drains
+ADDRINT ReachedOffset(ADDRINT count)
+{
+    return count >= offset_inst;
+}
+
+// Switch recording on or off and have all code instrumented again, so
+// that nothing is left behind outside the region and code translated
+// before it starts does not miss its branches; regionLock is held
+static VOID switch_region(bool on)
+{
+    if (record != on)
+    {
+        record = on;
+        PIN_RemoveInstrumentation();
+    }
+}
+
+static VOID set_region(bool on, THREADID tid)
+{
+    PIN_GetLock(&regionLock, tid + 1);
+    switch_region(on);
+    PIN_ReleaseLock(&regionLock);
+}
+
+VOID StartRecording(THREADID tid)
+{
+    set_region(true, tid);
+}
+
+// Entry and exit of the -roi_rtn routine; recursive calls inside the
+// region keep it open until the outermost one returns
+VOID RoiEnter(THREADID tid)
+{
+    PIN_GetLock(&regionLock, tid + 1);
+    bool start = ++roiCalls == roiCount || roiDepth > 0;
+    if (start)
+        roiDepth++;
+    PIN_ReleaseLock(&regionLock);
+    if (start)
+        set_region(true, tid);
+}
+
+VOID RoiExit(THREADID tid)
+{
+    PIN_GetLock(&regionLock, tid + 1);
+    bool stop = roiDepth > 0 && --roiDepth == 0;
+    PIN_ReleaseLock(&regionLock);
+    if (stop)
+        set_region(false, tid);
+}
+
+// SSC marker (mov $id, %ebx; addr32 fs nop); other ids are ignored
+VOID MarkerHit(ADDRINT id, THREADID tid)
+{
+    if ((INT64)id == roiMarkerStart)
+        set_region(true, tid);
+    else if ((INT64)id == roiMarkerStop)
+        set_region(false, tid);
+}
+
+// Checked at the start of every basic block in sampling mode, inlined
+ADDRINT ReachedSwitch(ADDRINT count, ADDRINT next)
+{
+    return count >= next;
+}
+
+// Record the thread entering or leaving a sample; branches are recorded
+// while any thread is inside one and BufferFull keeps each thread's own.
+// Returns the instruction count of the thread's next sample boundary
+ADDRINT SampleSwitch(THREADID tid, ADDRINT count)
+{
+    THREAD_DATA *td = static_cast<THREAD_DATA *>(PIN_GetThreadData(threadDataKey, tid));
+    UINT64 start;
+    BOOL in = sample_phase(count, &start) != PHASE_OUT;
+
+    if (in != td->inSample)
+    {
+        td->inSample = in;
+        PIN_GetLock(&regionLock, tid + 1);
+        if (in)
+            samplingThreads++;
+        else
+            samplingThreads--;
+        switch_region(samplingThreads > 0);
+        PIN_ReleaseLock(&regionLock);
+    }
+
+    if (in)
+        return start + sampleWarmup + sampleSize + 1;
+    if (count <= offset_inst)
+        return offset_inst + 1;
+    return start + samplePeriod + 1;
+}
+
+static bool is_ssc_marker(INS ins)
+{
+    static const UINT8 ssc[3] = {0x64, 0x67, 0x90};
+    UINT8 bytes[3];
+    return INS_Size(ins) == sizeof(bytes) &&
+           PIN_SafeCopy(bytes, (VOID *)INS_Address(ins), sizeof(bytes)) == sizeof(bytes) &&
+           !memcmp(bytes, ssc, sizeof(bytes));
+}
+
 VOID ImageLoad(IMG img, VOID *v)
 {
 
@@ -221,299 +792,155 @@ VOID ImageLoad(IMG img, VOID *v)
             }
         }
     }
+
+    // Routine calls are instrumented ahead of time, so the triggers stay
+    // in place when the rest of the instrumentation is removed
+    if (!roiRtn.empty())
+    {
+        RTN rtn = RTN_FindByName(img, roiRtn.c_str());
+        if (RTN_Valid(rtn))
+        {
+            printf("    ** region of interest %s at %p\n", roiRtn.c_str(), reinterpret_cast<void *>(RTN_Address(rtn)));
+            RTN_Open(rtn);
+            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)RoiEnter, IARG_THREAD_ID, IARG_END);
+            RTN_InsertCall(rtn, IPOINT_AFTER, (AFUNPTR)RoiExit, IARG_THREAD_ID, IARG_END);
+            RTN_Close(rtn);
+        }
+    }
 }
 
 /************
  *
- * JMP segment
+ * Trace buffer
  *
  */
 
-static VOID UnconDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-}
-
-static VOID UnconUnDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Not Direct
-            << "\n"
-            << flush;
-    ubcount++;
-}
-
-static VOID ConDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Conditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-}
-static VOID ConUnDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Conditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Not Direct
-            << "\n"
-            << flush;
-    cbcount++;
-}
-//****************************************************************
+// One branch as filled in by INS_InsertFillBuffer; the instruction count
+// is the value of icountReg at the branch, the branch itself included.
+// The target is only filled in for indirect branches
+struct BRANCH_RECORD
+{
+    ADDRINT target;
+    ADDRINT icount;
+    UINT32 id;    // Index in staticBranches
+    UINT32 flags; // BT_* flags known at instrumentation time
+    BOOL taken;
+};
 
-/************
- *
- * Ret segment
- *
- */
+// Drain a full (or, at thread exit, partial) trace buffer into the
+// thread's trace; no other thread touches it
+static VOID *BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v)
+{
+    THREAD_DATA *td = static_cast<THREAD_DATA *>(PIN_GetThreadData(threadDataKey, tid));
+    BRANCH_RECORD *rec = (BRANCH_RECORD *)buf;
+    const char *stopReason = NULL;
 
-static VOID UnconDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    retcount++;
-}
-
-static VOID UnconUnDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Ret
-            << "\t0"                         // Not Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    retcount++;
-}
-
-static VOID ConDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    retcount++;
-}
-static VOID ConUnDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Not Ret
-            << "\t0"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    retcount++;
-}
-//****************************************************************
+    // Set rollover, which closes files, is not used while simulating
+    predict_lock(td);
+    for (UINT64 i = 0; i < numElements && !td->done && !stopReason; i++, rec++)
+    {
+        // Recording starts once any thread passes the offset; each thread
+        // still skips its own first offset_inst instructions
+        if (rec->icount <= offset_inst)
+            continue;
 
-/************
- *
- * Call segment
- *
- */
-static VOID UnconDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    callcount++;
-}
-static VOID UnconUnDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    callcount++;
-}
-static VOID ConDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    callcount++;
-}
-static VOID ConUnDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    callcount++;
+        // Records past the end of the current set open the next one
+        while (howManyBranch > 0 && rec->icount > (howManyBranch * (td->fileCounter + 1)) + offset_inst - 1)
+        {
+            td->icount = (howManyBranch * (td->fileCounter + 1)) + offset_inst - 1;
+            td->fileCounter++;
+            if (td->fileCounter > howManySet - 1)
+            {
+                stopReason = "user conditions";
+                break;
+            }
+            file_init(td);
+        }
+        if (stopReason)
+            break;
+
+        if (rec->icount > td->icount)
+            td->icount = rec->icount;
+
+        // Records another thread's sample let through are dropped
+        if (samplePeriod > 0 && !sample_advance(td, rec->icount))
+            continue;
+
+        stage_branch(td, rec->id, rec->flags, rec->taken, rec->target, rec->icount);
+
+        if (rec->flags & BT_CONDITIONAL)
+            td->cbcount++;
+        else
+            td->ubcount++;
+        if (rec->flags & BT_CALL)
+            td->callcount++;
+        if (rec->flags & BT_RET)
+            td->retcount++;
+
+        // The limit bounds the size of a trace; a simulation has none
+        if (!online && td->cbcount >= CBCOUNT_LIMIT)
+        {
+            td->fileCounter++;
+            stopReason = "CBCOUNT_LIMIT";
+        }
+    }
+    predict_unlock(td);
+
+    if (stopReason)
+    {
+        if (finish_thread(td))
+        {
+            cout << "Exiting because of " << stopReason << endl;
+            PIN_ExitApplication(0);
+        }
+        cout << "Thread " << tid << " stopped because of " << stopReason << endl;
+    }
+    else if (!td->done)
+    {
+        flush_staged(td);
+        cout << td->icount << " " << td->cbcount << endl;
+    }
+
+    return buf;
 }
 //****************************************************************
 
-static VOID Instruction(INS ins, VOID *v)
+static VOID Instruction(INS ins)
 {
-    // Insert a call to docount before every instruction, no arguments are passed
-
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
+    if (roiMarkerStart >= 0 && is_ssc_marker(ins))
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)MarkerHit, IARG_REG_VALUE, REG_EBX, IARG_THREAD_ID, IARG_END);
 
     if (record)
     {
         if (INS_IsValidForIpointTakenBranch(ins))
         {
-            if (first_record)
-            { // Detected the first branch
-                first_inst_count_after_offset = 1;
-                first_record = false;
-            }
-            if (INS_HasFallThrough(ins) == false)
-            { // It is unconditional branch
-                if (INS_IsCall(ins))
-                { // It is call
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    { // direct
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconUnDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else if (INS_IsRet(ins))
-                { // It is RET
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconUnDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else
-                { // It is JMP
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconUnDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-            }
+            UINT32 flags = 0;
+            if (INS_HasFallThrough(ins))
+                flags |= BT_CONDITIONAL;
+            if (INS_IsCall(ins))
+                flags |= BT_CALL;
+            else if (INS_IsRet(ins))
+                flags |= BT_RET;
+            if (INS_IsDirectControlFlow(ins))
+                flags |= BT_DIRECT;
+            UINT32 id = branch_id(ins, flags);
+
+            // The target of a direct branch is in the static branch table
+            if (flags & BT_DIRECT)
+                INS_InsertFillBuffer(ins, IPOINT_BEFORE, bufId,
+                                     IARG_REG_VALUE, icountReg, offsetof(BRANCH_RECORD, icount),
+                                     IARG_UINT32, id, offsetof(BRANCH_RECORD, id),
+                                     IARG_UINT32, flags, offsetof(BRANCH_RECORD, flags),
+                                     IARG_BRANCH_TAKEN, offsetof(BRANCH_RECORD, taken),
+                                     IARG_END);
             else
-            { // It is conditional branch
-                if (INS_IsCall(ins))
-                { // It is call
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    { // direct
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConUnDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else if (INS_IsRet(ins))
-                { // It is RET
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConUnDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else
-                { // It is JMP
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConUnDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-            }
+                INS_InsertFillBuffer(ins, IPOINT_BEFORE, bufId,
+                                     IARG_BRANCH_TARGET_ADDR, offsetof(BRANCH_RECORD, target),
+                                     IARG_REG_VALUE, icountReg, offsetof(BRANCH_RECORD, icount),
+                                     IARG_UINT32, id, offsetof(BRANCH_RECORD, id),
+                                     IARG_UINT32, flags, offsetof(BRANCH_RECORD, flags),
+                                     IARG_BRANCH_TAKEN, offsetof(BRANCH_RECORD, taken),
+                                     IARG_END);
         }
     }
     // We do not care about instrunctions that are not branches.
@@ -521,6 +948,92 @@ static VOID Instruction(INS ins, VOID *v)
     //    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AtNonBranch, IARG_INST_PTR, IARG_END);
 }
 
+static VOID Trace(TRACE trace, VOID *v)
+{
+    bool roi = !roiRtn.empty() || roiMarkerStart >= 0;
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        // Count the whole block up front, before any branch in it is
+        // buffered, so a branch record includes the branch itself. With a
+        // region of interest only instructions inside it are counted
+        if (record || !roi)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)docount, IARG_REG_VALUE, icountReg, IARG_UINT32, BBL_NumIns(bbl), IARG_RETURN_REGS, icountReg, IARG_END);
+
+        if (samplePeriod > 0)
+        {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)ReachedSwitch, IARG_REG_VALUE, icountReg, IARG_REG_VALUE, switchReg, IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)SampleSwitch, IARG_THREAD_ID, IARG_REG_VALUE, icountReg, IARG_RETURN_REGS, switchReg, IARG_END);
+        }
+        else if (!record && !roi)
+        {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)ReachedOffset, IARG_REG_VALUE, icountReg, IARG_END);
+            BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)StartRecording, IARG_THREAD_ID, IARG_END);
+        }
+
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            Instruction(ins);
+    }
+}
+
+// Give the thread its own trace stream and start its instruction count
+// at zero
+static VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    PIN_SetContextReg(ctxt, icountReg, 0);
+    if (samplePeriod > 0)
+        PIN_SetContextReg(ctxt, switchReg, offset_inst + 1);
+
+    THREAD_DATA *td = new THREAD_DATA();
+    td->tid = tid;
+    init_sample_state(&td->sampleState);
+    open_files(td);
+    PIN_SetThreadData(threadDataKey, td, tid);
+
+    PIN_GetLock(&threadLock, tid + 1);
+    liveThreads++;
+    PIN_ReleaseLock(&threadLock);
+}
+
+// Stop the writer thread while internal threads still run normally; the
+// buffers drained at thread exit are written directly
+static VOID PrepareForFini(VOID *v)
+{
+    StopWriter();
+}
+
+// The last trace buffer of the thread has drained; close its files with
+// the final instruction count
+static VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    THREAD_DATA *td = static_cast<THREAD_DATA *>(PIN_GetThreadData(threadDataKey, tid));
+
+    PIN_GetLock(&threadLock, tid + 1);
+    liveThreads--;
+    if (td->done)
+        doneThreads--;
+    PIN_ReleaseLock(&threadLock);
+
+    if (td->inSample)
+    {
+        PIN_GetLock(&regionLock, tid + 1);
+        samplingThreads--;
+        switch_region(samplingThreads > 0);
+        PIN_ReleaseLock(&regionLock);
+    }
+
+    if (!td->done)
+    {
+        ADDRINT count = PIN_GetContextReg(ctxt, icountReg);
+        if (count > td->icount)
+            td->icount = count;
+        close_files(td);
+    }
+
+    delete td;
+    PIN_SetThreadData(threadDataKey, 0, tid);
+}
+
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
@@ -533,23 +1046,25 @@ INT32 Usage()
     return -1;
 }
 
+// The files themselves are opened per thread in ThreadStart
 INT32 InitFile()
 {
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << KnobOutputFile.Value() << "_" << fileCounter << ".out";
-    OutFile.open(filePrefix.str().c_str());
-    OutFile.setf(ios::showbase);
-
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << axuliryFileName << "_" << fileCounter << ".out";
-    axuFile.open(filePrefix.str().c_str());
-    axuFile.setf(ios::showbase);
-
     howManyBranch = strtoull(KnobHowManyBranch.Value().c_str(), NULL, 0);
     howManySet = strtoull(KnobHowManySet.Value().c_str(), NULL, 0);
     offset_inst = strtoull(KnobOffset.Value().c_str(), NULL, 0);
+    roiRtn = KnobRoiRtn.Value();
+    roiCount = strtoull(KnobRoiCount.Value().c_str(), NULL, 0);
+    roiMarkerStart = strtoll(KnobRoiMarkerStart.Value().c_str(), NULL, 0);
+    roiMarkerStop = strtoll(KnobRoiMarkerStop.Value().c_str(), NULL, 0);
+    samplePeriod = strtoull(KnobSamplePeriod.Value().c_str(), NULL, 0);
+    sampleWarmup = strtoull(KnobSampleWarmup.Value().c_str(), NULL, 0);
+    sampleSize = strtoull(KnobSampleSize.Value().c_str(), NULL, 0);
+    recordDisassembly = strtoull(KnobDisassembly.Value().c_str(), NULL, 0) != 0;
+    online = !KnobPredict.Value().empty();
+
+    // The region replaces the offset; its instructions are counted from 0
+    if (!roiRtn.empty() || roiMarkerStart >= 0)
+        offset_inst = 0;
     cout << "My offset " << offset_inst << endl;
 
     cout << KnobHowManyBranch.Value() << endl;
@@ -562,12 +1077,106 @@ int main(INT32 argc, CHAR **argv)
     PIN_Init(argc, argv);
     PIN_InitSymbols();
 
+    if (KnobCompress.Value() != "none" && KnobCompress.Value() != "bzip2" && KnobCompress.Value() != "zstd")
+    {
+        cerr << "Error: unknown compressor " << KnobCompress.Value() << endl;
+        return Usage();
+    }
+
     InitFile();
 
-    INS_AddInstrumentFunction(Instruction, 0);
+    if (roiCount == 0)
+    {
+        cerr << "Error: -roi_count counts calls from 1" << endl;
+        return Usage();
+    }
+
+    if (samplePeriod > 0)
+    {
+        if (sampleSize == 0 || sampleWarmup + sampleSize > samplePeriod)
+        {
+            cerr << "Error: a sample must measure at least one instruction and fit in -sample_period" << endl;
+            return Usage();
+        }
+        if (howManyBranch > 0 || !roiRtn.empty() || roiMarkerStart >= 0)
+        {
+            cerr << "Error: -sample_period cannot be combined with -m or a region of interest" << endl;
+            return Usage();
+        }
+    }
+
+    if (online)
+    {
+        if (howManyBranch > 0)
+        {
+            cerr << "Error: -predict cannot be combined with -m" << endl;
+            return Usage();
+        }
+
+        // Set up the predictor as the simulator does from its command line
+        bpType = STATIC;
+        verbose = 0;
+        istringstream options(KnobPredict.Value());
+        string option;
+        while (options >> option)
+        {
+            vector<char> arg(option.begin(), option.end());
+            arg.push_back('\0');
+            if (!handle_option(&arg[0]))
+            {
+                cerr << "Error: unrecognized predictor option " << option << endl;
+                options_usage();
+                return Usage();
+            }
+        }
+        init_predictor();
+    }
+
+    // Each thread gets its own trace buffer, drained by BufferFull
+    bufId = PIN_DefineTraceBuffer(sizeof(BRANCH_RECORD), NUM_BUF_PAGES, BufferFull, 0);
+    if (bufId == BUFFER_ID_INVALID)
+    {
+        cerr << "Error: could not allocate the trace buffer" << endl;
+        return 1;
+    }
+
+    icountReg = PIN_ClaimToolRegister();
+    if (!REG_valid(icountReg))
+    {
+        cerr << "Error: no tool register left for the instruction count" << endl;
+        return 1;
+    }
+    if (samplePeriod > 0)
+    {
+        switchReg = PIN_ClaimToolRegister();
+        if (!REG_valid(switchReg))
+        {
+            cerr << "Error: no tool register left for the sample boundary" << endl;
+            return 1;
+        }
+    }
+    threadDataKey = PIN_CreateThreadDataKey(0);
+    PIN_InitLock(&threadLock);
+    PIN_InitLock(&regionLock);
+    PIN_InitLock(&staticLock);
+    PIN_InitLock(&predictLock);
+
+    PIN_MutexInit(&writeMutex);
+    PIN_SemaphoreInit(&writeNotEmpty);
+    PIN_SemaphoreInit(&writeNotFull);
+    PIN_SemaphoreInit(&writerExited);
+    // Nothing is written while simulating
+    writerRunning = !online && PIN_SpawnInternalThread(WriterThread, NULL, 0, &writerUid) != INVALID_THREADID;
+    if (!writerRunning)
+        PIN_SemaphoreSet(&writerExited);
+
+    TRACE_AddInstrumentFunction(Trace, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
 
     // Register Fini to be called when the application exits
+    PIN_AddPrepareForFiniFunction(PrepareForFini, 0);
     PIN_AddFiniFunction(Fini, 0);
 
     PIN_StartProgram();
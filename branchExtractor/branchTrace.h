@@ -0,0 +1,112 @@
+/*
+    Binary branch trace format shared by branchExt and trace2txt.
+
+    A trace is a BRANCH_TRACE_HEADER followed by a sequence of entries,
+    one per executed branch, in execution order and in the byte order of
+    the machine that recorded it. trace2txt turns a trace into the text
+    format read by the simulator, which also reads this format directly.
+
+    Every entry starts with a varint (LEB128: 7 bits per byte, low bits
+    first, high bit set on all bytes but the last) holding an ID in the
+    bits above BT_ENTRY_TAG_BITS and a tag in the bits below:
+
+    BT_ENTRY_NOT_TAKEN, BT_ENTRY_TAKEN
+        An executed branch, by the ID of its static branch; followed by a
+        varint of the instructions executed since the previous branch of
+        the trace, the branch itself included, and the 64-bit target when
+        the branch is not BT_DIRECT.
+    BT_ENTRY_DEFINE
+        The static branch with this ID, written once per trace before its
+        first execution: 64-bit PC, 64-bit target (0 unless BT_DIRECT), the
+        BT_* flags other than BT_TAKEN, and a varint length followed by that
+        many bytes of disassembly (length 0 when not recorded).
+    BT_ENTRY_SAMPLE
+        A sample boundary (branchExt -sample_period) of the kind given by
+        the ID, followed by the 64-bit instruction count of the thread at
+        the boundary and the 64-bit number of instructions the sample stands
+        for (BT_SAMPLE_WARMUP only, 0 otherwise). The branches between
+        BT_SAMPLE_WARMUP and BT_SAMPLE_MEASURE only warm up the predictor;
+        those up to BT_SAMPLE_END are measured.
+
+    Versions:
+    1  No header, fixed-size records with 32-bit PC and target
+       (BRANCH_TRACE_RECORD_V1)
+    2  Header, fixed-size records with 64-bit PC and target
+       (BRANCH_TRACE_RECORD)
+    3  As 2, plus sample boundary records flagged BT_SAMPLE, with the kind
+       in BT_SAMPLE_KIND, the instruction count in `pc` and the weight in
+       `target`
+    4  Static branch definitions and compact entries
+    5  Instruction distance in branch entries
+*/
+
+#ifndef BRANCH_TRACE_H
+#define BRANCH_TRACE_H
+
+#include <stdint.h>
+
+#define BRANCH_TRACE_MAGIC "\177BRT"
+#define BRANCH_TRACE_VERSION 5
+
+// Flags of a trace record
+#define BT_TAKEN 0x01
+#define BT_CONDITIONAL 0x02
+#define BT_CALL 0x04
+#define BT_RET 0x08
+#define BT_DIRECT 0x10
+#define BT_SAMPLE 0x80
+
+// Kinds of sample boundary records
+#define BT_SAMPLE_WARMUP 0x00
+#define BT_SAMPLE_MEASURE 0x01
+#define BT_SAMPLE_END 0x02
+#define BT_SAMPLE_KIND 0x03
+
+// Entry tags
+#define BT_ENTRY_NOT_TAKEN 0
+#define BT_ENTRY_TAKEN 1
+#define BT_ENTRY_DEFINE 2
+#define BT_ENTRY_SAMPLE 3
+#define BT_ENTRY_TAG_BITS 2
+#define BT_ENTRY_TAG_MASK 0x03
+
+// Longest disassembly kept in a definition
+#define BT_MAX_DISASSEMBLY 255
+// Longest entry, a definition with the longest disassembly; a branch
+// entry takes at most 10 + 10 + 8 bytes
+#define BT_MAX_ENTRY_BYTES (10 + 8 + 8 + 1 + 2 + BT_MAX_DISASSEMBLY)
+
+struct BRANCH_TRACE_HEADER
+{
+    char magic[4];    // BRANCH_TRACE_MAGIC, which no text trace starts with
+    uint32_t version; // BRANCH_TRACE_VERSION
+};
+
+struct __attribute__((packed)) BRANCH_TRACE_RECORD
+{
+    uint64_t pc;     // Branch address
+    uint64_t target; // Branch target
+    uint8_t flags;   // BT_* flags
+};
+
+struct __attribute__((packed)) BRANCH_TRACE_RECORD_V1
+{
+    uint32_t pc;
+    uint32_t target;
+    uint8_t flags;
+};
+
+// Write 'value' as a varint at 'p'; returns the number of bytes written
+static inline unsigned bt_put_varint(uint8_t *p, uint64_t value)
+{
+    unsigned n = 0;
+    while (value >= 0x80)
+    {
+        p[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+#endif
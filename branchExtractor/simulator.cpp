@@ -0,0 +1,13 @@
+/*
+    The simulator's predictor and statistics (src/predictor.cpp and
+    src/simulate.cpp), built with the Pin CRT for branchExt -predict.
+
+    The Pin CRT headers define STATIC, which predictor.h uses for the
+    static scheme, so they are included first and the macro dropped before
+    the simulator's sources are compiled.
+*/
+
+#include <stdio.h>
+#undef STATIC
+#include "predictor.cpp"
+#include "simulate.cpp"
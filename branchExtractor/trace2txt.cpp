@@ -0,0 +1,229 @@
+/*
+    Converts a binary trace written by branchExt into the text format read
+    by the simulator:
+
+    // Branch Address, Branch Target, (Taken-Not taken), (Conditional-Unconditional), (Call-Not Call), (Ret-Not Ret), (Direct-NotDirect)[, Instructions]
+
+    The last column, the instructions executed since the previous branch,
+    is only written for traces that record it (version 5 on).
+
+    Usage: trace2txt [-t] <binary trace> [<text trace>]
+    The binary trace is read from stdin when given as `-`, so a compressed
+    trace can be converted with e.g. `bunzip2 -kc trace.bz2 | trace2txt -`.
+    The text trace is written to stdout when no output file is given.
+    Traces of every version in branchTrace.h are accepted. Sample
+    boundaries are written as lines of their own:
+
+    #sample <warmup|measure|end> <instruction count> <instructions the sample stands for>
+
+    With -t the static branch table of the trace is written instead, one
+    branch per line:
+
+    // ID, Branch Address, Static Target, (Conditional-Unconditional), (Call-Not Call), (Ret-Not Ret), (Direct-NotDirect), Disassembly
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include "branchTrace.h"
+
+struct STATIC_BRANCH
+{
+    bool defined;
+    uint64_t pc;
+    uint64_t target;
+    uint8_t flags;
+};
+
+// Bytes read while looking for the header of a trace that has none
+static char peeked[sizeof(BRANCH_TRACE_HEADER)];
+static size_t numPeeked = 0;
+
+static bool read_record(void *record, size_t size, FILE *in)
+{
+    size_t n = numPeeked < size ? numPeeked : size;
+    memcpy(record, peeked, n);
+    memmove(peeked, peeked + n, numPeeked - n);
+    numPeeked -= n;
+    return fread((char *)record + n, 1, size - n, in) == size - n;
+}
+
+static bool read_varint(uint64_t *value, FILE *in)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        uint8_t byte;
+        if (!read_record(&byte, 1, in))
+            return false;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static const char *sampleKindName[] = {"warmup", "measure", "end", "unknown"};
+
+// 'distance' is the instruction distance column, or -1 for none
+static void print_record(FILE *out, uint64_t pc, uint64_t target, uint8_t flags, int64_t distance = -1)
+{
+    if (flags & BT_SAMPLE)
+    {
+        fprintf(out, "#sample\t%s\t%" PRIu64 "\t%" PRIu64 "\n",
+                sampleKindName[flags & BT_SAMPLE_KIND], pc, target);
+        return;
+    }
+    fprintf(out, "%#" PRIx64 "\t%#" PRIx64 "\t%d\t%d\t%d\t%d\t%d", pc, target,
+            !!(flags & BT_TAKEN), !!(flags & BT_CONDITIONAL),
+            !!(flags & BT_CALL), !!(flags & BT_RET), !!(flags & BT_DIRECT));
+    if (distance >= 0)
+        fprintf(out, "\t%" PRId64, distance);
+    fputc('\n', out);
+}
+
+// Convert the entries of a version 4 or later trace; returns false if the
+// trace is malformed or truncated
+static bool convert_entries(FILE *in, FILE *out, uint32_t version, bool table)
+{
+    std::vector<STATIC_BRANCH> branches;
+    uint64_t entry;
+
+    while (read_varint(&entry, in))
+    {
+        uint64_t id = entry >> BT_ENTRY_TAG_BITS;
+        uint32_t tag = entry & BT_ENTRY_TAG_MASK;
+
+        if (tag == BT_ENTRY_DEFINE)
+        {
+            STATIC_BRANCH b;
+            uint64_t length;
+            b.defined = true;
+            if (!read_record(&b.pc, sizeof(b.pc), in) || !read_record(&b.target, sizeof(b.target), in) ||
+                !read_record(&b.flags, sizeof(b.flags), in) || !read_varint(&length, in) ||
+                length > BT_MAX_DISASSEMBLY)
+                return false;
+            std::string disassembly(length, '\0');
+            if (length > 0 && !read_record(&disassembly[0], length, in))
+                return false;
+
+            if (id >= branches.size())
+                branches.resize(id + 1);
+            branches[id] = b;
+            if (table)
+                fprintf(out, "%" PRIu64 "\t%#" PRIx64 "\t%#" PRIx64 "\t%d\t%d\t%d\t%d\t%s\n", id, b.pc, b.target,
+                        !!(b.flags & BT_CONDITIONAL), !!(b.flags & BT_CALL), !!(b.flags & BT_RET),
+                        !!(b.flags & BT_DIRECT), disassembly.c_str());
+        }
+        else if (tag == BT_ENTRY_SAMPLE)
+        {
+            uint64_t count, weight;
+            if (!read_record(&count, sizeof(count), in) || !read_record(&weight, sizeof(weight), in))
+                return false;
+            if (!table)
+                print_record(out, count, weight, BT_SAMPLE | (id & BT_SAMPLE_KIND));
+        }
+        else
+        {
+            if (id >= branches.size() || !branches[id].defined)
+                return false;
+            const STATIC_BRANCH &b = branches[id];
+            uint64_t target = b.target;
+            uint64_t distance = 0;
+            if (version >= 5 && !read_varint(&distance, in))
+                return false;
+            if (!(b.flags & BT_DIRECT) && !read_record(&target, sizeof(target), in))
+                return false;
+            if (!table)
+                print_record(out, b.pc, target, b.flags | (tag == BT_ENTRY_TAKEN ? BT_TAKEN : 0),
+                             version >= 5 ? (int64_t)distance : -1);
+        }
+    }
+    return !ferror(in) && feof(in);
+}
+
+int main(int argc, char **argv)
+{
+    const char *program = argv[0];
+    bool table = argc > 1 && !strcmp(argv[1], "-t");
+    if (table)
+    {
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "Usage: %s [-t] <binary trace> [<text trace>]\n", program);
+        return 1;
+    }
+
+    FILE *in = strcmp(argv[1], "-") ? fopen(argv[1], "rb") : stdin;
+    if (!in)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (argc == 3 && !(out = fopen(argv[2], "w")))
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    BRANCH_TRACE_HEADER header;
+    uint32_t version = 1;
+    numPeeked = fread(peeked, 1, sizeof(header), in);
+    if (numPeeked == sizeof(header) && !memcmp(peeked, BRANCH_TRACE_MAGIC, sizeof(header.magic)))
+    {
+        memcpy(&header, peeked, sizeof(header));
+        numPeeked = 0;
+        version = header.version;
+    }
+
+    if (table && version < 4)
+    {
+        fprintf(stderr, "%s: trace version %u has no static branch table\n", argv[1], version);
+        return 1;
+    }
+
+    if (version == 1)
+    {
+        BRANCH_TRACE_RECORD_V1 r;
+        while (read_record(&r, sizeof(r), in))
+            print_record(out, r.pc, r.target, r.flags);
+    }
+    else if (version == 2 || version == 3)
+    {
+        BRANCH_TRACE_RECORD r;
+        while (read_record(&r, sizeof(r), in))
+            print_record(out, r.pc, r.target, r.flags);
+    }
+    else if (version == 4 || version == 5)
+    {
+        if (!convert_entries(in, out, version, table))
+        {
+            fprintf(stderr, "%s: malformed or truncated trace\n", argv[1]);
+            return 1;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "%s: unsupported trace version %u\n", argv[1], version);
+        return 1;
+    }
+
+    if (ferror(in))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -7,11 +7,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "predictor.h"
+#include "simulate.h"
+#include "branchTrace.h" // Binary traces written by branchExtractor
 
 FILE *stream;
 char *buf = NULL;
 size_t len = 0;
+int binaryTrace = 0;
+uint32_t traceVersion = 0;
+SampleState sampleState;
+
+// The static branches defined so far by a version 4 trace, by ID
+typedef struct
+{
+  uint64_t pc;
+  uint64_t target;
+  uint8_t flags;
+  uint8_t defined;
+} trace_branch;
+trace_branch *traceBranches = NULL;
+uint64_t numTraceBranches = 0;
 
 #ifdef _WIN32
 // Windows fallback for getline
@@ -55,62 +72,202 @@ void usage()
   fprintf(stderr, "       bunzip2 -kc trace.bz2 | predictor <options>\n");
   fprintf(stderr, " Options:\n");
   fprintf(stderr, " --help       Print this message\n");
-  fprintf(stderr, " --verbose    Print predictions on stdout\n");
-  fprintf(stderr, " --<type>     Branch prediction scheme:\n");
-  fprintf(stderr, "    static\n"
-                  "    gshare\n"
-                  "    tournament\n"
-                  "    custom\n");
+  options_usage();
 }
 
-// Process an option and update the predictor
-// configuration variables accordingly
+// Checks whether the input stream is a binary trace and consumes its
+// header if so
 //
-// Returns True if Successful
+// Returns False if the binary trace has an unsupported version
 //
-int handle_option(char *arg)
+int open_trace()
 {
-  if (!strcmp(arg, "--static"))
+  int c = getc(stream);
+  if (c == EOF || ungetc(c, stream) == EOF || c != BRANCH_TRACE_MAGIC[0])
   {
-    bpType = STATIC;
+    return 1;
   }
-  else if (!strncmp(arg, "--gshare", 8))
-  {
-    bpType = GSHARE;
-  }
-  else if (!strncmp(arg, "--tournament", 12))
-  {
-    bpType = TOURNAMENT;
-  }
-  else if (!strncmp(arg, "--custom", 8))
+
+  BRANCH_TRACE_HEADER header;
+  if (fread(&header, sizeof(header), 1, stream) != 1 ||
+      memcmp(header.magic, BRANCH_TRACE_MAGIC, sizeof(header.magic)))
   {
-    bpType = CUSTOM;
+    return 0;
   }
-  else if (!strcmp(arg, "--verbose"))
+  binaryTrace = 1;
+  traceVersion = header.version;
+  return traceVersion >= 2 && traceVersion <= BRANCH_TRACE_VERSION;
+}
+
+// Reads a varint or a 64-bit value of a version 4 trace
+//
+// Returns True if Successful
+//
+int read_varint(uint64_t *value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
   {
-    verbose = 1;
+    int c = getc(stream);
+    if (c == EOF)
+    {
+      return 0;
+    }
+    *value |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+    {
+      return 1;
+    }
   }
-  else
+  return 0;
+}
+
+int read_u64(uint64_t *value)
+{
+  return fread(value, sizeof(*value), 1, stream) == 1;
+}
+
+// Reads the entries of a version 4 trace up to the next branch, keeping
+// the static branches it defines
+//
+// Returns True if Successful
+//
+int read_entry(uint64_t *pc, uint64_t *target, uint8_t *flags, uint64_t *instructions)
+{
+  uint64_t entry;
+  while (read_varint(&entry))
   {
-    return 0;
-  }
+    uint64_t id = entry >> BT_ENTRY_TAG_BITS;
+    uint32_t tag = entry & BT_ENTRY_TAG_MASK;
 
-  return 1;
+    if (tag == BT_ENTRY_DEFINE)
+    {
+      if (id >= numTraceBranches)
+      {
+        uint64_t n = numTraceBranches ? numTraceBranches : 1024;
+        while (n <= id)
+        {
+          n *= 2;
+        }
+        traceBranches = (trace_branch *)realloc(traceBranches, n * sizeof(trace_branch));
+        memset(traceBranches + numTraceBranches, 0, (n - numTraceBranches) * sizeof(trace_branch));
+        numTraceBranches = n;
+      }
+      trace_branch *b = &traceBranches[id];
+      uint64_t length;
+      int c = 0;
+      if (!read_u64(&b->pc) || !read_u64(&b->target) || (c = getc(stream)) == EOF || !read_varint(&length))
+      {
+        return 0;
+      }
+      b->flags = c;
+      b->defined = 1;
+      // The disassembly is of no use here
+      while (length-- > 0 && getc(stream) != EOF)
+        ;
+    }
+    else if (tag == BT_ENTRY_SAMPLE)
+    {
+      uint64_t count, weight;
+      if (!read_u64(&count) || !read_u64(&weight))
+      {
+        return 0;
+      }
+      sample_boundary(&sampleState, id, count, weight);
+    }
+    else
+    {
+      if (id >= numTraceBranches || !traceBranches[id].defined)
+      {
+        return 0;
+      }
+      *pc = traceBranches[id].pc;
+      *target = traceBranches[id].target;
+      *flags = traceBranches[id].flags | (tag == BT_ENTRY_TAKEN ? BT_TAKEN : 0);
+      if (traceVersion >= 5 && !read_varint(instructions))
+      {
+        return 0;
+      }
+      return (*flags & BT_DIRECT) || read_u64(target);
+    }
+  }
+  return 0;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Reads a line (or a record, from a binary trace) from the input stream
+// and extracts the PC and Outcome of a branch, and the instructions
+// executed since the previous branch, the branch included (0 when the
+// trace does not record them)
 //
 // Returns True if Successful
 //
-int read_branch(uint32_t *pc, uint32_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct)
+// Sample boundaries met on the way are handled by sample_boundary
+//
+int read_branch(uint64_t *pc, uint64_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct, uint64_t *instructions)
 {
-  if (getline(&buf, &len, stream) == -1)
+  *instructions = 0;
+  if (binaryTrace && traceVersion >= 4)
   {
-    return 0;
+    uint8_t flags;
+    if (!read_entry(pc, target, &flags, instructions))
+    {
+      return 0;
+    }
+    *outcome = !!(flags & BT_TAKEN);
+    *condition = !!(flags & BT_CONDITIONAL);
+    *call = !!(flags & BT_CALL);
+    *ret = !!(flags & BT_RET);
+    *direct = !!(flags & BT_DIRECT);
+    return 1;
+  }
+
+  if (binaryTrace)
+  {
+    BRANCH_TRACE_RECORD record;
+    uint8_t flags;
+    do
+    {
+      if (fread(&record, sizeof(record), 1, stream) != 1)
+      {
+        return 0;
+      }
+      *pc = record.pc;
+      *target = record.target;
+      flags = record.flags;
+      if (flags & BT_SAMPLE)
+      {
+        sample_boundary(&sampleState, flags & BT_SAMPLE_KIND, *pc, *target);
+      }
+    } while (flags & BT_SAMPLE);
+    *outcome = !!(flags & BT_TAKEN);
+    *condition = !!(flags & BT_CONDITIONAL);
+    *call = !!(flags & BT_CALL);
+    *ret = !!(flags & BT_RET);
+    *direct = !!(flags & BT_DIRECT);
+    return 1;
   }
 
-  sscanf(buf, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", pc, target, outcome, condition, call, ret, direct);
+  char kind[16];
+  while (1)
+  {
+    if (getline(&buf, &len, stream) == -1)
+    {
+      return 0;
+    }
+    if (sscanf(buf, "#sample\t%15s\t%" SCNu64 "\t%" SCNu64, kind, pc, target) != 3)
+    {
+      break;
+    }
+    for (uint32_t i = SAMPLE_WARMUP; i <= SAMPLE_END; i++)
+    {
+      if (!strcmp(kind, sampleKindName[i]))
+      {
+        sample_boundary(&sampleState, i, *pc, *target);
+      }
+    }
+  }
+
+  sscanf(buf, "%" SCNx64 "\t%" SCNx64 "\t%d\t%d\t%d\t%d\t%d\t%" SCNu64 "\n", pc, target, outcome, condition, call, ret, direct, instructions);
 
   return 1;
 }
@@ -142,49 +299,36 @@ int main(int argc, char *argv[])
     else
     {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      stream = fopen(argv[i], "rb");
     }
   }
 
+  if (!open_trace())
+  {
+    printf("Unsupported binary trace version\n");
+    exit(1);
+  }
+
   // Initialize the predictor
   init_predictor();
+  init_sample_state(&sampleState);
 
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint32_t target = 0;
+  uint64_t pc = 0;
+  uint64_t target = 0;
   uint32_t outcome = NOTTAKEN;
   uint32_t condition = 0;
   uint32_t call = 0;
   uint32_t ret = 0;
   uint32_t direct = 0;
+  uint64_t instructions = 0;
 
   // Reach each branch from the trace
-  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct, &instructions))
   {
-    if (condition == 1)
-    {
-      num_branches++;
-      // Make a prediction and compare with actual outcome
-      uint32_t prediction = make_prediction(pc, target, direct);
-      if (prediction != outcome)
-      {
-        mispredictions++;
-      }
-      if (verbose != 0)
-      {
-        printf("%d\n", prediction);
-      }
-    }
-    // Train the predictor
-    train_predictor(pc, target, outcome, condition, call, ret, direct);
+    simulate_branch(&sampleState, pc, target, outcome, condition, call, ret, direct, instructions);
   }
 
-  // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
-  float mispredict_rate = 1000 * ((float)mispredictions / (float)num_branches);
-  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  print_statistics();
 
   // Cleanup
   fclose(stream);
@@ -6,9 +6,16 @@
 //  described in the README                               //
 //========================================================//
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "predictor.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <cpuid.h>
+#define PREDICTOR_X86_SIMD 1
+#endif
+
 //
 // TODO:Student Information
 //
@@ -21,11 +28,52 @@ const char *email = "d6gupta@ucsd.edu";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[4] = {"Static", "Gshare",
-                         "Tournament", "Custom"};
+const char *bpName[10] = {"Static", "Gshare",
+                          "Tournament", "Custom", "Perceptron",
+                          "Hashed Perceptron", "YAGS", "Bi-Mode",
+                          "2bc-gskew", "Two-Level"};
+const char *twoLevelName[6] = {"GAg", "GAp", "PAg", "PAp", "SAg", "SAs"};
+const char *confidenceName[3] = {"Low", "Medium", "High"};
+const char *indexHashName[3] = {"xor", "fold", "path"};
+const char *uncondHistoryName[3] = {"none", "all", "callret"};
+const char *btbPolicyName[3] = {"lru", "fifo", "random"};
+const char *rasOverflowName[2] = {"wrap", "drop"};
+const char *rasUnderflowName[2] = {"wrap", "empty"};
 
 // define number of bits required for indexing the BHT here.
 int ghistoryBits = 15; // Number of bits used for Global History
+int lhistoryBits = 10; // Number of bits used for Local History (tournament, fixed)
+int pcIndexBits = 10;  // Number of bits used for PC index (tournament, fixed)
+int perceptronHistoryBits = 31; // Global history length of the perceptron
+int perceptronWeightBits = 8;   // Width of a perceptron weight (2 to 8 bits)
+int perceptronEntries = 256;    // Number of perceptron weight vectors
+int hashedTableBits = 9;        // log2 of the entries in each hashed perceptron table
+int hashedWeightBits = 8;       // Width of a hashed perceptron weight (2 to 8 bits)
+int bimodeTableBits = 13;       // log2 of the entries in each bi-mode table
+int bimodeHistoryBits = 13;     // Global history length of bi-mode
+int gskewBankBits = 13;         // log2 of the entries in each 2bc-gskew bank
+int gskewHistoryBits = 13;      // Global history length of 2bc-gskew
+int indexHash = HASH_XOR;       // Hash of PC and history used by gshare, bi-mode and YAGS
+int uncondHistory = UNCOND_NONE; // Which unconditional branches update global history
+int twoLevelScheme = TWOLEVEL_GAG; // Yeh-Patt scheme of the two-level predictor
+int yagsChoiceBits = 13;        // log2 of the YAGS choice PHT entries
+int yagsCacheBits = 10;         // log2 of the sets in each YAGS direction cache
+int yagsWays = 2;               // YAGS direction cache associativity
+int yagsTagBits = 8;            // YAGS direction cache tag width
+int loopOverride = 0;           // Let a loop predictor override the selected predictor
+int loopLogSets = 4;            // log2 of the loop predictor sets
+int loopWays = 4;               // Loop predictor associativity
+int btbEnabled = 0;             // Model a branch target buffer fed by every branch
+int btbLogSets = 9;             // log2 of the BTB sets
+int btbWays = 4;                // BTB associativity
+int btbTagBits = 12;            // BTB tag width
+int btbPolicy = BTB_LRU;        // BTB replacement policy
+int rasEnabled = 0;             // Model a return address stack driven by calls and returns
+int rasDepth = 16;              // Return address stack entries
+int rasOverflow = RAS_WRAP;     // What a call does to a full return address stack
+int rasUnderflow = RAS_WRAP;    // What a return does to an empty return address stack
+int ittageEnabled = 0;          // Model an ITTAGE indirect target predictor
+int updateDelay = 0;            // Branches between a prediction and its table update
 int bpType;            // Branch Prediction Type
 int verbose;
 
@@ -36,43 +84,587 @@ int verbose;
 //
 // TODO: Add your own Branch Predictor data structures here
 //
+// Packed table storage
+// Entries of any width up to 64 bits are stored back to back in 64-bit
+// words, so a table occupies exactly numEntries * entryBits of memory
+typedef struct {
+  uint64_t *words;
+  uint64_t entryMask;
+  uint32_t entryBits;
+  uint32_t numEntries;
+} packed_table;
+
+// Word level accessors, shared by packed_table and the fixed size tables
+// of the two-level engine (where entryBits is a compile-time constant)
+static inline uint64_t packed_words_get(const uint64_t *words, uint32_t idx, uint32_t entryBits, uint64_t entryMask)
+{
+  uint64_t bit = (uint64_t)idx * entryBits;
+  uint64_t word = bit >> 6;
+  uint32_t shift = bit & 63;
+  uint64_t value = words[word] >> shift;
+  if (shift + entryBits > 64)
+  {
+    value |= words[word + 1] << (64 - shift);
+  }
+  return value & entryMask;
+}
+
+static inline void packed_words_set(uint64_t *words, uint32_t idx, uint32_t entryBits, uint64_t entryMask, uint64_t value)
+{
+  uint64_t bit = (uint64_t)idx * entryBits;
+  uint64_t word = bit >> 6;
+  uint32_t shift = bit & 63;
+  value &= entryMask;
+  words[word] = (words[word] & ~(entryMask << shift)) | (value << shift);
+  if (shift + entryBits > 64)
+  {
+    uint32_t spill = 64 - shift;
+    words[word + 1] = (words[word + 1] & ~(entryMask >> spill)) | (value >> spill);
+  }
+}
+
+static inline uint64_t packed_get(const packed_table *table, uint32_t idx)
+{
+  return packed_words_get(table->words, idx, table->entryBits, table->entryMask);
+}
+
+static inline void packed_set(packed_table *table, uint32_t idx, uint64_t value)
+{
+  packed_words_set(table->words, idx, table->entryBits, table->entryMask, value);
+}
+
+// Words needed to pack 'entries' entries of 'bits' bits, plus the spare word
+#define PACKED_WORDS(entries, bits) (((uint64_t)(entries) * (bits) + 63) / 64 + 1)
+
+// Confidence of a 'bits' wide saturating counter: high when saturated,
+// medium one step away (3-bit and wider counters only), low otherwise
+static inline uint8_t counter_confidence(uint32_t ctr, uint32_t bits)
+{
+  uint32_t max = (1u << bits) - 1;
+  if (ctr == 0 || ctr == max)
+    return CONF_HIGH;
+  if (bits >= 3 && (ctr == 1 || ctr == max - 1))
+    return CONF_MEDIUM;
+  return CONF_LOW;
+}
+
+// Confidence of a perceptron output 'y' against its training threshold
+static inline uint8_t output_confidence(int32_t y, int32_t theta)
+{
+  if (abs(y) > theta)
+    return CONF_HIGH;
+  if (abs(y) > theta / 3)
+    return CONF_MEDIUM;
+  return CONF_LOW;
+}
+
+// Full target of the branch at 'pc' from the low 32 bits kept by a BTB or
+// ITTAGE entry; the upper bits come from the PC, so a target outside the
+// branch's 4GB region is never predicted
+static inline uint64_t region_target(uint64_t pc, uint32_t low)
+{
+  return (pc & ~0xffffffffULL) | low;
+}
+
+// Two-level adaptive predictor engine (Yeh and Patt)
+// The first level keeps branch histories: one global register (G), a
+// register per branch address (P) or per set of branches (S). The second
+// level is a pattern table of saturating counters indexed by the history,
+// either one global table (g) or one table per address (p) or set (s).
+// Every size is a template parameter, so each configuration is a separate
+// instantiation whose index arithmetic is resolved at compile time.
+typedef enum {
+    TL_GLOBAL = 0,
+    TL_PER_ADDRESS,
+    TL_PER_SET
+} two_level_select;
+
+// Branches of the same 64-byte block form a set
+#define TWO_LEVEL_SET_SHIFT 6
+
+template <two_level_select HistorySelect, int HistoryTableBits, int HistoryBits,
+          two_level_select PhtSelect, int PhtTableBits, int CounterBits>
+struct two_level_predictor
+{
+  static const uint32_t historyEntries = 1u << HistoryTableBits;
+  static const uint32_t phtEntries = 1u << (PhtTableBits + HistoryBits);
+  static const uint64_t historyMask = (1ULL << HistoryBits) - 1;
+  static const uint64_t counterMask = (1ULL << CounterBits) - 1;
+  static const uint8_t counterTaken = 1 << (CounterBits - 1);
+
+  uint64_t histories[PACKED_WORDS(historyEntries, HistoryBits)];
+  uint64_t pht[PACKED_WORDS(phtEntries, CounterBits)];
+
+  template <two_level_select Select, int Bits>
+  static inline uint32_t select(uint64_t pc)
+  {
+    if (Select == TL_GLOBAL || Bits == 0)
+      return 0;
+    if (Select == TL_PER_ADDRESS)
+      return pc & ((1u << Bits) - 1);
+    return (pc >> TWO_LEVEL_SET_SHIFT) & ((1u << Bits) - 1);
+  }
+
+  void init()
+  {
+    memset(histories, 0, sizeof(histories));
+    // Counters start weakly not taken
+    for (uint32_t i = 0; i < phtEntries; i++)
+    {
+      packed_words_set(pht, i, CounterBits, counterMask, counterTaken - 1);
+    }
+  }
+
+  uint32_t history(uint64_t pc) const
+  {
+    return packed_words_get(histories, select<HistorySelect, HistoryTableBits>(pc), HistoryBits, historyMask);
+  }
+
+  uint32_t pht_index(uint64_t pc) const
+  {
+    return (select<PhtSelect, PhtTableBits>(pc) << HistoryBits) | history(pc);
+  }
+
+  uint8_t predict(uint64_t pc) const
+  {
+    return packed_words_get(pht, pht_index(pc), CounterBits, counterMask) >= counterTaken;
+  }
+
+  uint8_t confidence(uint64_t pc) const
+  {
+    return counter_confidence(packed_words_get(pht, pht_index(pc), CounterBits, counterMask), CounterBits);
+  }
+
+  void train(uint64_t pc, uint8_t outcome)
+  {
+    uint32_t index = pht_index(pc);
+    uint64_t ctr = packed_words_get(pht, index, CounterBits, counterMask);
+    if (outcome == TAKEN && ctr < counterMask)
+      ctr++;
+    else if (outcome == NOTTAKEN && ctr > 0)
+      ctr--;
+    packed_words_set(pht, index, CounterBits, counterMask, ctr);
+
+    update_history(pc, outcome);
+  }
+
+  void update_history(uint64_t pc, uint8_t outcome)
+  {
+    uint32_t h = select<HistorySelect, HistoryTableBits>(pc);
+    uint64_t value = packed_words_get(histories, h, HistoryBits, historyMask);
+    packed_words_set(histories, h, HistoryBits, historyMask, (value << 1) | outcome);
+  }
+
+  // Shift a bit into the history only when it is a global register
+  void update_global_history(uint8_t bit)
+  {
+    if (HistorySelect == TL_GLOBAL)
+      update_history(0, bit);
+  }
+
+  uint64_t storage_bits() const
+  {
+    return (uint64_t)historyEntries * HistoryBits + (uint64_t)phtEntries * CounterBits;
+  }
+};
+
 // gshare
-uint8_t *bht_gshare;
+packed_table bht_gshare;
 uint64_t ghistory;
 
+// path history, shared by all predictors
+// A few hashed target and PC bits of every taken branch, conditional or not
+#define PATH_BITS_PER_BRANCH 3
+#define PATH_HISTORY_BITS 63 // 21 branches
+uint64_t pathHistory;
+
+// bi-mode
+// A choice PHT indexed by PC steers each branch to the taken or the
+// not-taken direction PHT, both indexed like gshare
+packed_table bimodeChoice;
+packed_table bimodeTaken;
+packed_table bimodeNotTaken;
+uint64_t bimodeHistory;
+
+// 2bc-gskew
+// A bimodal bank and two skewed gshare-like banks vote (e-gskew) and a
+// skewed meta bank chooses between the bimodal bank and the vote
+packed_table gskewBim;
+packed_table gskewG0;
+packed_table gskewG1;
+packed_table gskewMeta;
+uint64_t gskewHistory;
+
 // tournament
-// Local Histrory Table of 1024 entries of 10 bits each
-uint16_t *localHistoryTable;
-uint8_t *bht_tournament;
-uint8_t *bht_global;
-uint8_t *choice_bht;
-uint16_t globalHistory;
-
-// custom branch predictor data structures
-uint8_t *base_bht_custom;
+// Alpha 21264 style: a PAg local component with 1024 10-bit histories and
+// 3-bit counters, a GAg global component over 12 bits of history with
+// 2-bit counters, and a choice PHT indexed by the global history
+#define TOURNAMENT_LHISTORY_BITS 10
+#define TOURNAMENT_PC_INDEX_BITS 10
+#define TOURNAMENT_GHISTORY_BITS 12
+two_level_predictor<TL_PER_ADDRESS, TOURNAMENT_PC_INDEX_BITS, TOURNAMENT_LHISTORY_BITS, TL_GLOBAL, 0, 3> tournamentLocal;
+two_level_predictor<TL_GLOBAL, 0, TOURNAMENT_GHISTORY_BITS, TL_GLOBAL, 0, 2> tournamentGlobal;
+packed_table choice_bht;
+
+// two-level
+// One instantiation per scheme of the Yeh-Patt taxonomy, each sized to
+// fit the 64Kbit budget
+two_level_predictor<TL_GLOBAL, 0, 15, TL_GLOBAL, 0, 2> twoLevelGAg;          // 65536 + 15
+two_level_predictor<TL_GLOBAL, 0, 11, TL_PER_ADDRESS, 4, 2> twoLevelGAp;     // 65536 + 11
+two_level_predictor<TL_PER_ADDRESS, 11, 14, TL_GLOBAL, 0, 2> twoLevelPAg;    // 28672 + 32768
+two_level_predictor<TL_PER_ADDRESS, 11, 10, TL_PER_ADDRESS, 4, 2> twoLevelPAp; // 20480 + 32768
+two_level_predictor<TL_PER_SET, 9, 14, TL_GLOBAL, 0, 2> twoLevelSAg;         // 7168 + 32768
+two_level_predictor<TL_PER_SET, 9, 12, TL_PER_SET, 2, 2> twoLevelSAs;        // 6144 + 32768
+
+// custom branch predictor data structures (TAGE-SC-L)
+// Bimodal base predictor
+#define TAGE_BASE_BITS 11
+packed_table tageBase;
+
+// Folded (compressed) view of the newest origLength global history bits,
+// updated incrementally so every table probe costs O(1)
+typedef struct {
+    uint32_t comp;       // Folded value
+    uint32_t compLength; // Width of the folded value
+    uint32_t origLength; // History length being folded
+    uint32_t outpoint;   // origLength % compLength
+} folded_history;
+
+// A tagged entry is packed as | useful(2) | ctr(3) | tag(numTagBits) |
+#define TAGE_CTR_SHIFT(table) ((table)->numTagBits)
+#define TAGE_USEFUL_SHIFT(table) ((table)->numTagBits + 3)
+#define TAGE_ENTRY_BITS(table) ((table)->numTagBits + 5)
+#define TAGE_CTR_MAX 7
+
 typedef struct {
     uint32_t tag;
-    // Prediction Counter
+    // Prediction Counter, taken when >= 4
     uint8_t ctr;
     // Useful Counter
     uint8_t useful;
 } tage_table_entry;
 
 typedef struct {
-    tage_table_entry *tagTable;
-    uint32_t tableSize;
+    packed_table tagTable;
+    uint32_t logSize;
     uint32_t historyBits;
     uint32_t numTagBits;
-    uint32_t numEntries;
+    folded_history indexFold;
+    folded_history tagFold[2];
 } tage_table;
 
-tage_table tageTables[4] = {
-    {.tableSize = 4096, .historyBits = 4, .numTagBits = 8},
-    {.tableSize = 2048, .historyBits = 8, .numTagBits = 10},
-    {.tableSize = 1024, .historyBits = 16, .numTagBits = 10},
-    {.tableSize = 512, .historyBits = 32, .numTagBits = 12}
+// Geometric history lengths, shortest first
+tage_table tageTables[] = {
+    {.logSize = 9, .historyBits = 4, .numTagBits = 7},
+    {.logSize = 9, .historyBits = 7, .numTagBits = 7},
+    {.logSize = 9, .historyBits = 13, .numTagBits = 8},
+    {.logSize = 9, .historyBits = 24, .numTagBits = 9},
+    {.logSize = 9, .historyBits = 44, .numTagBits = 10},
+    {.logSize = 9, .historyBits = 80, .numTagBits = 11},
+    {.logSize = 9, .historyBits = 145, .numTagBits = 11},
+    {.logSize = 8, .historyBits = 260, .numTagBits = 12}
+};
+#define TAGE_NUM_TABLES (int)(sizeof(tageTables) / sizeof(tageTables[0]))
+#define TAGE_MAX_TABLES 16
+#define TAGE_MAX_HISTORY 260
+#define TAGE_HIST_BUFFER 1024 // Power of two above TAGE_MAX_HISTORY
+#define TAGE_PATH_BITS 16
+#define TAGE_USEFUL_RESET_PERIOD (1 << 18)
+
+uint8_t tageHistory[TAGE_HIST_BUFFER]; // Circular global history, newest at tageHistoryPtr
+uint32_t tageHistoryPtr;
+uint32_t tagePath;
+int8_t useAltOnNa;    // USE_ALT_ON_NA, 4-bit signed
+uint32_t tageTick;    // Conditional branches since the last useful aging
+uint32_t tageAllocSeed;
+
+// Everything a TAGE probe finds for one branch
+typedef struct {
+    uint32_t index[TAGE_MAX_TABLES];
+    uint32_t tag[TAGE_MAX_TABLES];
+    uint32_t baseIndex;
+    int provider;          // Longest matching table, -1 for the base predictor
+    int alt;               // Next longest matching table, -1 for the base predictor
+    uint8_t providerPred;
+    uint8_t altPred;
+    uint8_t providerNew;   // Provider looks newly allocated (weak and not useful)
+    uint8_t highConf;      // Provider counter is saturated
+    uint8_t pred;          // TAGE prediction
+} tage_prediction;
+
+// Statistical corrector: a bias table indexed by the TAGE prediction and
+// its confidence plus GEHL tables over global history
+#define SC_LOG 7
+#define SC_WEIGHT_BITS 6
+#define SC_WEIGHT_MAX ((1 << (SC_WEIGHT_BITS - 1)) - 1)
+
+typedef struct {
+    packed_table weights;
+    uint32_t historyBits;
+    folded_history fold;
+} sc_table;
+
+sc_table scBias;
+sc_table scTables[] = {
+    {.historyBits = 6},
+    {.historyBits = 14},
+    {.historyBits = 30}
+};
+#define SC_NUM_TABLES (int)(sizeof(scTables) / sizeof(scTables[0]))
+int32_t scThreshold;        // Confidence needed to override TAGE
+int32_t scThresholdCounter; // Drives the threshold adaptation
+
+// Loop predictor: tagged entries that learn the trip count of loops with
+// a constant number of iterations and predict their exit
+#define LOOP_TAG_BITS 10
+#define LOOP_ITER_BITS 10
+#define LOOP_CONF_BITS 2
+#define LOOP_AGE_BITS 3
+#define LOOP_CONF_MAX ((1 << LOOP_CONF_BITS) - 1)
+#define LOOP_AGE_MAX ((1 << LOOP_AGE_BITS) - 1)
+#define LOOP_ITER_MAX ((1 << LOOP_ITER_BITS) - 1)
+
+typedef struct {
+    uint16_t tag;
+    uint16_t pastIter;    // Trip count observed for the loop
+    uint16_t currentIter; // Iterations seen in the current trip
+    uint8_t confidence;   // Consecutive trips with the same count
+    uint8_t age;          // Replacement priority
+    uint8_t dir;          // Direction of the loop body branch
+} loop_entry;
+
+typedef struct {
+    loop_entry *entries;
+    uint32_t logSets;
+    uint32_t ways;
+    int8_t withLoop;      // 7-bit signed, loop overrides only when >= 0
+} loop_predictor;
+
+loop_predictor tageLoop;
+
+// yags
+// The choice PHT gives each branch its bias; the taken cache holds the
+// taken exceptions of not-taken biased branches and the not-taken cache
+// the reverse. An entry is packed as | valid | lru | ctr(2) | tag |, the
+// lru field ranking the ways of a set from most (0) to least recently used
+typedef struct {
+    uint32_t tag;
+    uint8_t ctr;
+    uint8_t lru;
+    uint8_t valid;
+} yags_entry;
+
+typedef struct {
+    packed_table entries;
+    uint32_t lruBits;
+} yags_cache;
+
+packed_table yagsChoice;
+yags_cache yagsTakenCache;
+yags_cache yagsNotTakenCache;
+uint64_t yagsHistory;
+
+// loop override, usable with any predictor
+loop_predictor overrideLoop;
+uint64_t loopOverrides;        // Predictions changed by the loop predictor
+uint64_t loopOverridesCorrect; // ... of which were correct
+
+// branch target buffer
+// Set-associative, indexed by the low PC bits and holding the target of
+// taken branches. An entry is packed as | valid | rank | target | tag |,
+// the rank field ordering the ways of a set by recency (LRU) or by age
+// (FIFO) from 0 up; random replacement keeps no rank
+#define BTB_TARGET_BITS 32
+typedef struct {
+    uint32_t tag;
+    uint32_t target;
+    uint8_t rank;
+    uint8_t valid;
+} btb_entry;
+
+packed_table btb;
+uint32_t btbRankBits;
+uint32_t btbSeed;
+uint64_t btbLookups;      // Branches looked up in the BTB
+uint64_t btbHits;         // ... that found an entry
+uint64_t btbTargetMisses; // Taken branches whose target the BTB did not supply
+
+// return address stack
+// A circular stack of call PCs. The trace has no instruction lengths, so
+// a return counts as correctly predicted when its target lies within the
+// longest x86 instruction after the popped call. Entries hold full
+// 48-bit virtual addresses, as returns often cross between images.
+#define RAS_MAX_CALL_LENGTH 15
+#define RAS_ADDRESS_BITS 48
+uint64_t *rasStack;
+uint32_t rasTop;        // Slot the next call is pushed to
+uint32_t rasCount;      // Valid entries
+uint32_t rasDropped;    // Calls dropped by a full stack and not yet returned from
+uint64_t rasReturns;    // Returns seen
+uint64_t rasPredicted;  // ... for which the stack gave a prediction
+uint64_t rasCorrect;    // ... that was correct
+uint64_t rasOverflows;  // Calls made with the stack full
+uint64_t rasUnderflows; // Returns made with the stack empty
+
+// indirect target predictor (ITTAGE)
+// A tagless PC-indexed base table holding the last target seen, which on
+// its own is the BTB-only baseline, backed by tagged tables indexed with
+// geometric lengths of a global history that conditional outcomes and
+// indirect targets shift into. A tagged entry is packed as
+// | useful(1) | ctr(2) | target | tag |
+#define ITTAGE_BASE_BITS 10
+#define ITTAGE_TARGET_BITS 32
+#define ITTAGE_CTR_MAX 3
+#define ITTAGE_USEFUL_RESET_PERIOD (1 << 16)
+
+typedef struct {
+    uint32_t tag;
+    uint32_t target;
+    // Confidence Counter, the target is replaced when it is 0
+    uint8_t ctr;
+    uint8_t useful;
+} ittage_entry;
+
+typedef struct {
+    packed_table entries;
+    uint32_t logSize;
+    uint32_t historyBits;
+    uint32_t numTagBits;
+    folded_history indexFold;
+    folded_history tagFold[2];
+} ittage_table;
+
+// Geometric history lengths, shortest first
+ittage_table ittageTables[] = {
+    {.logSize = 9, .historyBits = 4, .numTagBits = 9},
+    {.logSize = 9, .historyBits = 10, .numTagBits = 10},
+    {.logSize = 9, .historyBits = 20, .numTagBits = 11},
+    {.logSize = 8, .historyBits = 40, .numTagBits = 12},
+    {.logSize = 8, .historyBits = 80, .numTagBits = 13},
+    {.logSize = 7, .historyBits = 160, .numTagBits = 14}
+};
+#define ITTAGE_NUM_TABLES (int)(sizeof(ittageTables) / sizeof(ittageTables[0]))
+
+packed_table ittageBase;
+uint8_t ittageHistory[TAGE_HIST_BUFFER]; // Circular global history, newest at ittageHistoryPtr
+uint32_t ittageHistoryPtr;
+uint32_t ittageTick;         // Indirect branches since the last useful reset
+uint64_t ittageLookups;      // Indirect branches predicted
+uint64_t ittageCorrect;      // ... whose target ITTAGE predicted
+uint64_t ittageBaseCorrect;  // ... whose target the base table alone predicted
+
+// Everything an ITTAGE probe finds for one branch
+typedef struct {
+    uint32_t index[TAGE_MAX_TABLES];
+    uint32_t tag[TAGE_MAX_TABLES];
+    int provider; // Longest matching table, or -1
+    int alt;      // Next longest matching table, or -1
+    uint32_t baseIndex;
+    uint32_t baseTarget;
+    uint32_t providerTarget;
+    uint32_t altTarget; // Target of the alternate, or of the base table
+    uint32_t target;    // Final prediction
+} ittage_prediction;
+
+// perceptron
+// Weights are int8 regardless of perceptronWeightBits and every vector is
+// padded to a multiple of 32 weights so the SIMD kernels never need a tail
+#define PERCEPTRON_VECTOR_ALIGN 32
+int8_t *perceptronWeights;   // perceptronEntries vectors, bias weight first
+int8_t *perceptronInputs;    // +1/-1 per history bit, bias input first, 0 padded
+uint32_t perceptronStride;   // Padded number of weights per vector
+int32_t perceptronTheta;     // Training threshold
+int8_t perceptronMaxWeight;  // Weights saturate at +/- perceptronMaxWeight
+
+typedef int32_t (*perceptron_dot_fn)(const int8_t *weights, const int8_t *inputs, uint32_t n);
+typedef void (*perceptron_train_fn)(int8_t *weights, const int8_t *inputs, uint32_t n, uint8_t outcome, int8_t maxWeight);
+perceptron_dot_fn perceptron_dot;
+perceptron_train_fn perceptron_train;
+
+// hashed perceptron
+// Each feature selects a weight from its own table through a hash of a
+// slice of one of the history registers, and the selected weights are summed
+typedef enum {
+    HP_BIAS = 0, // PC only
+    HP_GHIST,    // Bits [start, start + length) of the global history
+    HP_PATH,     // Bits [start, start + length) of the path history
+    HP_LOCAL,    // Bits [start, start + length) of the branch's local history
+    HP_PC        // Bits [start, start + length) of the PC
+} hpFeatureType;
+
+typedef struct {
+    hpFeatureType type;
+    uint32_t start;
+    uint32_t length;
+} hp_feature;
+
+hp_feature hpFeatures[] = {
+    {.type = HP_BIAS},
+    {.type = HP_GHIST, .start = 0, .length = 3},
+    {.type = HP_GHIST, .start = 0, .length = 6},
+    {.type = HP_GHIST, .start = 0, .length = 10},
+    {.type = HP_GHIST, .start = 0, .length = 16},
+    {.type = HP_GHIST, .start = 0, .length = 24},
+    {.type = HP_GHIST, .start = 0, .length = 36},
+    {.type = HP_GHIST, .start = 0, .length = 52},
+    {.type = HP_GHIST, .start = 0, .length = 76},
+    {.type = HP_GHIST, .start = 0, .length = 110},
+    {.type = HP_GHIST, .start = 32, .length = 128},
+    {.type = HP_PATH, .start = 0, .length = 12},
+    {.type = HP_PATH, .start = 0, .length = 30},
+    {.type = HP_LOCAL, .start = 0, .length = 11},
+    {.type = HP_PC, .start = 4, .length = 12}
 };
-uint32_t baseTableEntries = 256;
+#define HP_NUM_FEATURES (sizeof(hpFeatures) / sizeof(hpFeatures[0]))
+#define HP_HISTORY_WORDS 4   // 256 bits of global history
+#define HP_PATH_BITS 3       // PC bits shifted into the path history per branch
+#define HP_LOCAL_ENTRIES 256 // Local history table entries
+#define HP_LOCAL_BITS 11     // Local history length
+
+int8_t *hpWeights;                   // All feature tables back to back, plus zero padding
+int32_t *hpIndex;                    // Offset of the selected weight for each feature
+uint32_t hpIndexCount;               // HP_NUM_FEATURES padded to the gather width
+uint64_t hpHistory[HP_HISTORY_WORDS];
+uint64_t hpPath;
+packed_table hpLocalHistory;
+int32_t hpTheta;                     // Adaptive training threshold
+int32_t hpThresholdCounter;          // Drives the threshold adaptation
+int8_t hpMaxWeight;
+
+typedef int32_t (*hashed_sum_fn)(const int8_t *weights, const int32_t *index, uint32_t n);
+hashed_sum_fn hashed_sum;
+
+// delayed update
+// With updateDelay > 0 a branch updates the histories speculatively when
+// it is predicted, and trains the tables updateDelay branches later
+// against the histories it was predicted with. The history state of the
+// selected predictor is described as a list of memory regions so it can
+// be checkpointed per branch and restored
+#define HISTORY_MAX_REGIONS 8
+typedef struct {
+    void *base;
+    size_t bytes;
+} history_region;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t target;
+    uint32_t outcome;
+    uint32_t condition;
+    uint32_t call;
+    uint32_t ret;
+    uint32_t direct;
+    uint8_t *checkpoint; // Histories before the branch was predicted
+} delayed_update;
+
+history_region historyRegions[HISTORY_MAX_REGIONS];
+int numHistoryRegions;
+size_t historyBytes;
+delayed_update *delayedUpdates; // Ring of updateDelay + 1 branches
+uint32_t delayedHead;           // Oldest branch not yet trained
+uint32_t delayedCount;
+uint8_t *historyScratch;
+uint64_t historyRepairs;        // Mispredictions repaired from a checkpoint
 
 
 
@@ -81,6 +673,85 @@ uint32_t baseTableEntries = 256;
 //        Predictor Functions         //
 //------------------------------------//
 
+// Packed table functions
+
+void packed_init(packed_table *table, uint32_t numEntries, uint32_t entryBits, uint64_t value)
+{
+  uint64_t totalBits = (uint64_t)numEntries * entryBits;
+  // One spare word lets an entry straddling the last boundary be read safely
+  uint64_t numWords = (totalBits + 63) / 64 + 1;
+  table->words = (uint64_t *)calloc(numWords, sizeof(uint64_t));
+  table->entryBits = entryBits;
+  table->entryMask = (entryBits == 64) ? ~0ULL : ((1ULL << entryBits) - 1);
+  table->numEntries = numEntries;
+  for (uint32_t i = 0; i < numEntries; i++)
+  {
+    packed_set(table, i, value);
+  }
+}
+
+void packed_free(packed_table *table)
+{
+  free(table->words);
+  table->words = NULL;
+}
+
+// Number of bits of modelled hardware held by the table
+uint64_t packed_bits(const packed_table *table)
+{
+  return (uint64_t)table->numEntries * table->entryBits;
+}
+
+// Shared 2-bit counter update
+uint8_t update_2bit(uint8_t ctr, uint8_t outcome)
+{
+  if (outcome == TAKEN)
+    return (ctr < ST) ? ctr + 1 : ST;
+  return (ctr > SN) ? ctr - 1 : SN;
+}
+
+// XOR-fold the newest 'length' bits of a history register to 'outBits'
+uint32_t fold_register(uint64_t history, uint32_t length, uint32_t outBits)
+{
+  if (length < 64)
+    history &= (1ULL << length) - 1;
+  uint32_t folded = 0;
+  for (uint32_t i = 0; i < length; i += outBits)
+  {
+    folded ^= (uint32_t)(history >> i);
+  }
+  return folded & ((1 << outBits) - 1);
+}
+
+// Hash a branch address with a history register into an 'indexBits' wide
+// table index, using the scheme selected by indexHash. Only the newest
+// 'historyBits' bits of the history take part
+uint32_t index_hash(uint64_t pc, uint64_t history, uint32_t historyBits, uint32_t indexBits)
+{
+  uint32_t mask = (1 << indexBits) - 1;
+  uint64_t recent = (historyBits < 64) ? history & ((1ULL << historyBits) - 1) : history;
+  switch (indexHash)
+  {
+  case HASH_FOLD:
+    return (pc ^ fold_register(history, historyBits, indexBits)) & mask;
+  case HASH_PATH:
+    return (pc ^ recent ^ fold_register(pathHistory, PATH_HISTORY_BITS, indexBits)) & mask;
+  case HASH_XOR:
+  default:
+    return (pc ^ recent) & mask;
+  }
+}
+
+// Shift a taken branch into the path history
+void update_path_history(uint64_t pc, uint64_t target)
+{
+  uint32_t bits = (target ^ (target >> PATH_BITS_PER_BRANCH) ^ pc) & ((1 << PATH_BITS_PER_BRANCH) - 1);
+  pathHistory = (pathHistory << PATH_BITS_PER_BRANCH) | bits;
+}
+
+
+
+
 // Initialize the predictor
 //
 
@@ -88,23 +759,15 @@ uint32_t baseTableEntries = 256;
 void init_gshare()
 {
   int bht_entries = 1 << ghistoryBits;
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
-  {
-    bht_gshare[i] = WN;
-  }
+  packed_init(&bht_gshare, bht_entries, 2, WN);
   ghistory = 0;
 }
 
-uint8_t gshare_predict(uint32_t pc)
+uint8_t gshare_predict(uint64_t pc)
 {
   // get lower ghistoryBits of pc
-  uint32_t bht_entries = 1 << ghistoryBits;
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-  uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
-  switch (bht_gshare[index])
+  uint32_t index = index_hash(pc, ghistory, ghistoryBits, ghistoryBits);
+  switch (packed_get(&bht_gshare, index))
   {
   case WN:
     return NOTTAKEN;
@@ -120,28 +783,30 @@ uint8_t gshare_predict(uint32_t pc)
   }
 }
 
-void train_gshare(uint32_t pc, uint8_t outcome)
+uint8_t gshare_confidence(uint64_t pc)
+{
+  return counter_confidence(packed_get(&bht_gshare, index_hash(pc, ghistory, ghistoryBits, ghistoryBits)), 2);
+}
+
+void train_gshare(uint64_t pc, uint8_t outcome)
 {
   // get lower ghistoryBits of pc
-  uint32_t bht_entries = 1 << ghistoryBits;
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-  uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
+  uint32_t index = index_hash(pc, ghistory, ghistoryBits, ghistoryBits);
 
   // Update state of entry in bht based on outcome
-  switch (bht_gshare[index])
+  switch (packed_get(&bht_gshare, index))
   {
   case WN:
-    bht_gshare[index] = (outcome == TAKEN) ? WT : SN;
+    packed_set(&bht_gshare, index, (outcome == TAKEN) ? WT : SN);
     break;
   case SN:
-    bht_gshare[index] = (outcome == TAKEN) ? WN : SN;
+    packed_set(&bht_gshare, index, (outcome == TAKEN) ? WN : SN);
     break;
   case WT:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WN;
+    packed_set(&bht_gshare, index, (outcome == TAKEN) ? ST : WN);
     break;
   case ST:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WT;
+    packed_set(&bht_gshare, index, (outcome == TAKEN) ? ST : WT);
     break;
   default:
     printf("Warning: Undefined state of entry in GSHARE BHT!\n");
@@ -152,114 +817,266 @@ void train_gshare(uint32_t pc, uint8_t outcome)
   ghistory = ((ghistory << 1) | outcome);
 }
 
+uint64_t gshare_storage_bits()
+{
+  return packed_bits(&bht_gshare) + ghistoryBits;
+}
+
 void cleanup_gshare()
 {
-  free(bht_gshare);
+  packed_free(&bht_gshare);
 }
 
 
 
 
-// Tournament predictor functions
+// Bi-mode functions
 
-void init_tournament()
+void init_bimode()
 {
-  uint32_t localHistoryEntries = 1024; // 10 bits for local history
-  uint32_t globalHistoryEntries = 4096; // 12 bits for global history
-  localHistoryTable = (uint16_t *)malloc(localHistoryEntries * sizeof(uint16_t));
-  bht_tournament = (uint8_t *)malloc(localHistoryEntries * sizeof(uint8_t));
-  bht_global = (uint8_t *)malloc(globalHistoryEntries * sizeof(uint8_t));
-  choice_bht = (uint8_t *)malloc(globalHistoryEntries * sizeof(uint8_t));
-  int i = 0;
+  uint32_t entries = 1 << bimodeTableBits;
+  packed_init(&bimodeChoice, entries, 2, WN);
+  packed_init(&bimodeTaken, entries, 2, WT);
+  packed_init(&bimodeNotTaken, entries, 2, WN);
+  bimodeHistory = 0;
+}
 
-  for (i = 0; i < localHistoryEntries; i++)
-  {
-    localHistoryTable[i] = 0;
-    bht_tournament[i] = WN3_3bit;
-  }
-  for (i = 0; i < globalHistoryEntries; i++)
-  {
-    bht_global[i] = WN;
-    choice_bht[i] = WLocal;
-  }
-  globalHistory = 0;
+uint32_t bimode_index(uint64_t pc)
+{
+  return index_hash(pc, bimodeHistory, bimodeHistoryBits, bimodeTableBits);
+}
+
+uint8_t bimode_predict(uint64_t pc)
+{
+  uint8_t choice = packed_get(&bimodeChoice, pc & ((1 << bimodeTableBits) - 1)) >= WT;
+  packed_table *direction = (choice == TAKEN) ? &bimodeTaken : &bimodeNotTaken;
+  return packed_get(direction, bimode_index(pc)) >= WT;
+}
+
+uint8_t bimode_confidence(uint64_t pc)
+{
+  uint8_t choice = packed_get(&bimodeChoice, pc & ((1 << bimodeTableBits) - 1)) >= WT;
+  packed_table *direction = (choice == TAKEN) ? &bimodeTaken : &bimodeNotTaken;
+  return counter_confidence(packed_get(direction, bimode_index(pc)), 2);
 }
 
-uint8_t tournament_global_predict(uint32_t pc)
+void train_bimode(uint64_t pc, uint8_t outcome)
 {
-  switch (bht_global[globalHistory])
+  uint32_t choiceIndex = pc & ((1 << bimodeTableBits) - 1);
+  uint32_t index = bimode_index(pc);
+  uint8_t choiceCtr = packed_get(&bimodeChoice, choiceIndex);
+  uint8_t choice = choiceCtr >= WT;
+  packed_table *direction = (choice == TAKEN) ? &bimodeTaken : &bimodeNotTaken;
+  uint8_t ctr = packed_get(direction, index);
+  uint8_t prediction = ctr >= WT;
+
+  // Only the selected direction PHT is trained
+  packed_set(direction, index, update_2bit(ctr, outcome));
+
+  // The choice is kept when it was wrong but its direction PHT was right
+  if (!(choice != outcome && prediction == outcome))
   {
-  case WN:
-    return NOTTAKEN;
-  case SN:
-    return NOTTAKEN;
-  case WT:
-    return TAKEN;
-  case ST:
-    return TAKEN;
-  default:
-    printf("Warning: Undefined state of entry in Global BHT!\n");
-    return NOTTAKEN;
+    packed_set(&bimodeChoice, choiceIndex, update_2bit(choiceCtr, outcome));
   }
+
+  // Update history register
+  bimodeHistory = ((bimodeHistory << 1) | outcome);
+}
+
+uint64_t bimode_storage_bits()
+{
+  return packed_bits(&bimodeChoice) + packed_bits(&bimodeTaken) +
+         packed_bits(&bimodeNotTaken) + bimodeHistoryBits;
+}
+
+void cleanup_bimode()
+{
+  packed_free(&bimodeChoice);
+  packed_free(&bimodeTaken);
+  packed_free(&bimodeNotTaken);
+}
+
+
+
+
+// 2bc-gskew functions
+
+// Skewing functions of Seznec and Bodin over n-bit values:
+// H(y_n, ..., y_1) = (y_n ^ y_1, y_n, ..., y_2) and its inverse
+uint32_t skew_h(uint32_t y, uint32_t n)
+{
+  return (y >> 1) | ((((y >> (n - 1)) ^ y) & 1) << (n - 1));
+}
+
+uint32_t skew_h_inv(uint32_t y, uint32_t n)
+{
+  uint32_t mask = (1 << n) - 1;
+  return ((y << 1) & mask) | (((y >> (n - 1)) ^ (y >> (n - 2))) & 1);
+}
+
+void gskew_index(uint64_t pc, uint32_t *g0, uint32_t *g1, uint32_t *meta)
+{
+  uint32_t n = gskewBankBits;
+  uint32_t mask = (1 << n) - 1;
+  uint32_t v1 = pc & mask;
+  uint32_t v2 = fold_register(gskewHistory, gskewHistoryBits, n) ^ ((pc >> n) & mask);
+  *g0 = (skew_h(v1, n) ^ skew_h_inv(v2, n) ^ v2) & mask;
+  *g1 = (skew_h(v1, n) ^ skew_h_inv(v2, n) ^ v1) & mask;
+  *meta = (skew_h_inv(v1, n) ^ skew_h(v2, n) ^ v2) & mask;
+}
+
+void init_gskew()
+{
+  uint32_t entries = 1 << gskewBankBits;
+  packed_init(&gskewBim, entries, 2, WN);
+  packed_init(&gskewG0, entries, 2, WN);
+  packed_init(&gskewG1, entries, 2, WN);
+  packed_init(&gskewMeta, entries, 2, WN);
+  gskewHistory = 0;
+}
+
+uint8_t gskew_predict(uint64_t pc)
+{
+  uint32_t g0, g1, meta;
+  gskew_index(pc, &g0, &g1, &meta);
+  uint8_t bim = packed_get(&gskewBim, pc & ((1 << gskewBankBits) - 1)) >= WT;
+  uint8_t vote = (bim + (packed_get(&gskewG0, g0) >= WT) + (packed_get(&gskewG1, g1) >= WT)) >= 2;
+  // Meta counter taken means trust the e-gskew vote
+  return (packed_get(&gskewMeta, meta) >= WT) ? vote : bim;
 }
 
-uint8_t tournament_local_predict(uint32_t pc)
+// High when all three banks agree, medium when a strong meta counter
+// selects a component, low otherwise
+uint8_t gskew_confidence(uint64_t pc)
 {
-  // get lower localHistoryBits of pc
-  uint32_t bht_entries = 1024;
-  uint32_t index = pc & (bht_entries - 1);
+  uint32_t g0, g1, meta;
+  gskew_index(pc, &g0, &g1, &meta);
+  uint8_t votes = (packed_get(&gskewBim, pc & ((1 << gskewBankBits) - 1)) >= WT) +
+                  (packed_get(&gskewG0, g0) >= WT) + (packed_get(&gskewG1, g1) >= WT);
+  if (votes == 0 || votes == 3)
+    return CONF_HIGH;
+  return (counter_confidence(packed_get(&gskewMeta, meta), 2) == CONF_HIGH) ? CONF_MEDIUM : CONF_LOW;
+}
 
-  switch (bht_tournament[localHistoryTable[index]])
+void train_gskew(uint64_t pc, uint8_t outcome)
+{
+  uint32_t g0, g1, meta;
+  gskew_index(pc, &g0, &g1, &meta);
+  uint32_t bimIndex = pc & ((1 << gskewBankBits) - 1);
+  uint8_t bimCtr = packed_get(&gskewBim, bimIndex);
+  uint8_t g0Ctr = packed_get(&gskewG0, g0);
+  uint8_t g1Ctr = packed_get(&gskewG1, g1);
+  uint8_t metaCtr = packed_get(&gskewMeta, meta);
+  uint8_t bim = bimCtr >= WT;
+  uint8_t p0 = g0Ctr >= WT;
+  uint8_t p1 = g1Ctr >= WT;
+  uint8_t vote = (bim + p0 + p1) >= 2;
+  uint8_t useVote = metaCtr >= WT;
+  uint8_t prediction = useVote ? vote : bim;
+
+  if (prediction != outcome)
   {
-  case SN_3bit:
-  case WN1_3bit:
-  case WN2_3bit:
-  case WN3_3bit:
-    return NOTTAKEN;
-  case WT1_3bit:
-  case WT2_3bit:
-  case WT3_3bit:
-  case ST_3bit:
-    return TAKEN;
-  default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
-    return NOTTAKEN;
+    // Misprediction: every voting bank learns
+    packed_set(&gskewBim, bimIndex, update_2bit(bimCtr, outcome));
+    packed_set(&gskewG0, g0, update_2bit(g0Ctr, outcome));
+    packed_set(&gskewG1, g1, update_2bit(g1Ctr, outcome));
   }
-  return NOTTAKEN;
+  else if (useVote)
+  {
+    // Partial update: strengthen only the banks that voted correctly
+    if (bim == outcome)
+      packed_set(&gskewBim, bimIndex, update_2bit(bimCtr, outcome));
+    if (p0 == outcome)
+      packed_set(&gskewG0, g0, update_2bit(g0Ctr, outcome));
+    if (p1 == outcome)
+      packed_set(&gskewG1, g1, update_2bit(g1Ctr, outcome));
+  }
+  else
+  {
+    packed_set(&gskewBim, bimIndex, update_2bit(bimCtr, outcome));
+  }
+
+  // The meta bank learns only when its two candidates disagree
+  if (bim != vote)
+  {
+    packed_set(&gskewMeta, meta, update_2bit(metaCtr, vote == outcome));
+  }
+
+  // Update history register
+  gskewHistory = ((gskewHistory << 1) | outcome);
+}
+
+uint64_t gskew_storage_bits()
+{
+  return packed_bits(&gskewBim) + packed_bits(&gskewG0) + packed_bits(&gskewG1) +
+         packed_bits(&gskewMeta) + gskewHistoryBits;
+}
+
+void cleanup_gskew()
+{
+  packed_free(&gskewBim);
+  packed_free(&gskewG0);
+  packed_free(&gskewG1);
+  packed_free(&gskewMeta);
+}
+
+
+
+
+// Tournament predictor functions
+
+void init_tournament()
+{
+  tournamentLocal.init();
+  tournamentGlobal.init();
+  packed_init(&choice_bht, 1 << TOURNAMENT_GHISTORY_BITS, 2, WLocal);
 }
 
-uint8_t tournament_predict(uint32_t pc)
+uint8_t tournament_predict(uint64_t pc)
 {
-  uint8_t choice = choice_bht[globalHistory];
+  uint8_t choice = packed_get(&choice_bht, tournamentGlobal.history(pc));
   if (choice == SLocal || choice == WLocal)
   {
-    return tournament_local_predict(pc);
+    return tournamentLocal.predict(pc);
   }
   else 
   {
-    return tournament_global_predict(pc);
+    return tournamentGlobal.predict(pc);
+  }
+}
+
+// Confidence of the component the choice PHT selects
+uint8_t tournament_confidence(uint64_t pc)
+{
+  uint8_t choice = packed_get(&choice_bht, tournamentGlobal.history(pc));
+  if (choice == SLocal || choice == WLocal)
+  {
+    return tournamentLocal.confidence(pc);
   }
+  return tournamentGlobal.confidence(pc);
 }
 
-void train_tournament_choice(uint32_t pc, uint8_t outcome, uint8_t local_pred, uint8_t global_pred)
+void train_tournament_choice(uint64_t pc, uint8_t outcome, uint8_t local_pred, uint8_t global_pred)
 {
   // Update choice predictor
   if (global_pred != local_pred)
   {
-    switch (choice_bht[globalHistory])
+    uint32_t index = tournamentGlobal.history(pc);
+    uint8_t globalWins = (global_pred == outcome && local_pred != outcome);
+    switch (packed_get(&choice_bht, index))
     {
       // Update state of entry in bht based on outcome
       case SGlobal:
-        choice_bht[globalHistory] = (global_pred == outcome && local_pred != outcome) ? SGlobal : WGlobal;
+        packed_set(&choice_bht, index, globalWins ? SGlobal : WGlobal);
         break;
       case WGlobal:
-        choice_bht[globalHistory] = (global_pred == outcome && local_pred != outcome) ? SGlobal : WLocal;
+        packed_set(&choice_bht, index, globalWins ? SGlobal : WLocal);
         break;
       case WLocal:
-        choice_bht[globalHistory] = (global_pred == outcome && local_pred != outcome) ? WGlobal : SLocal;
+        packed_set(&choice_bht, index, globalWins ? WGlobal : SLocal);
         break;
       case SLocal:
-        choice_bht[globalHistory] = (global_pred == outcome && local_pred != outcome) ? WLocal : SLocal;
+        packed_set(&choice_bht, index, globalWins ? WLocal : SLocal);
         break;
       default:
         printf("Warning: Undefined state of entry in Choice BHT!\n");
@@ -268,533 +1085,2432 @@ void train_tournament_choice(uint32_t pc, uint8_t outcome, uint8_t local_pred, u
   }
 }
 
-void train_tournament_global(uint32_t pc, uint8_t outcome)
+void train_tournament(uint64_t pc, uint8_t outcome)
 {
-  // Update state of entry in bht based on outcome
-  switch (bht_global[globalHistory])
-  {
-  case WN:
-    bht_global[globalHistory] = (outcome == TAKEN) ? WT : SN;
-    break;
-  case SN:
-    bht_global[globalHistory] = (outcome == TAKEN) ? WN : SN;
-    break;
-  case WT:
-    bht_global[globalHistory] = (outcome == TAKEN) ? ST : WN;
-    break;
-  case ST:
-    bht_global[globalHistory] = (outcome == TAKEN) ? ST : WT;
-    break;
-  default:
-    printf("Warning: Undefined state of entry in Global BHT!\n");
-    break;
-  }
+  uint8_t local_pred = tournamentLocal.predict(pc);
+  uint8_t global_pred = tournamentGlobal.predict(pc);
 
-  // Update history register
-  globalHistory = ((globalHistory << 1) | outcome) & 0xFFF; // keep only 12 bits
+  train_tournament_choice(pc, outcome, local_pred, global_pred);
+  tournamentGlobal.train(pc, outcome);
+  tournamentLocal.train(pc, outcome);
 }
 
-void train_tournament_local(uint32_t pc, uint8_t outcome)
+uint64_t tournament_storage_bits()
 {
-    // get lower localHistoryBits of pc
-  uint32_t bht_entries = 1024;
-  uint32_t index = pc & (bht_entries - 1);
-
-  // Update state of entry in bht based on outcome
-  switch (bht_tournament[localHistoryTable[index]])
-  {
-    // SN_3bit, WN1_3bit, WN2_3bit, WN3_3bit, WT1_3bit, WT2_3bit, WT3_3bit, ST_3bit
-  case SN_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? WN1_3bit : SN_3bit;
-    break;
-  case WN1_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? WN2_3bit : SN_3bit;
-    break;
-  case WN2_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? WN3_3bit : WN1_3bit;
-    break;
-  case WN3_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? WT1_3bit : WN2_3bit;
-    break;
-  case WT1_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? WT2_3bit : WN3_3bit;
-    break;
-  case WT2_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? WT3_3bit : WT1_3bit;
-    break;
-  case WT3_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? ST_3bit : WT2_3bit;
-    break;
-  case ST_3bit:
-    bht_tournament[localHistoryTable[index]] = (outcome == TAKEN) ? ST_3bit : WT3_3bit;
-    break;
-  default:
-    printf("Warning: Undefined state of entry in localHistoryTable BHT!\n");
-    break;
-  }
-
-  // Update history register
-  localHistoryTable[index] = ((localHistoryTable[index] << 1) | outcome) & 0x3FF; // keep only 10 bits
-}
-
-void train_tournament(uint32_t pc, uint8_t outcome)
-{
-  uint8_t local_pred = tournament_local_predict(pc);
-  uint8_t global_pred = tournament_global_predict(pc);
-
-  train_tournament_choice(pc, outcome, local_pred, global_pred);
-  train_tournament_global(pc, outcome);
-  train_tournament_local(pc, outcome);
-}
+  return tournamentLocal.storage_bits() + tournamentGlobal.storage_bits() + packed_bits(&choice_bht);
+}
 
 void cleanup_tournament()
 {
-  free(localHistoryTable);
-  free(bht_tournament);
-  free(bht_global);
+  packed_free(&choice_bht);
 }
 
 
 
 
-// Custom Predictor functions
-void init_custom()
-{
-  uint32_t i;
-  base_bht_custom = (uint8_t *)malloc(baseTableEntries * sizeof(uint8_t));
+// Two-level predictor functions
 
-  for (int idx = 0; idx < 4; idx++)
+void init_twolevel()
+{
+  switch (twoLevelScheme)
   {
-    tageTables[idx].tagTable = (tage_table_entry *)malloc(tageTables[idx].tableSize * sizeof(tage_table_entry));
-    for (i = 0; i < tageTables[idx].tableSize; i++)
-    {
-      tageTables[idx].tagTable[i].tag = 0xFFFFFFFF;
-      tageTables[idx].tagTable[i].useful = U0;
-      tageTables[idx].tagTable[i].ctr = WN;
-    }
-    tageTables[idx].numEntries = 0;
+  case TWOLEVEL_GAG: twoLevelGAg.init(); break;
+  case TWOLEVEL_GAP: twoLevelGAp.init(); break;
+  case TWOLEVEL_PAG: twoLevelPAg.init(); break;
+  case TWOLEVEL_PAP: twoLevelPAp.init(); break;
+  case TWOLEVEL_SAG: twoLevelSAg.init(); break;
+  case TWOLEVEL_SAS: twoLevelSAs.init(); break;
+  default: break;
   }
+}
 
-  ghistory = 0;
-    for (i = 0; i < baseTableEntries; i++)
+uint8_t twolevel_predict(uint64_t pc)
+{
+  switch (twoLevelScheme)
   {
-    base_bht_custom[i] = WN;
+  case TWOLEVEL_GAG: return twoLevelGAg.predict(pc);
+  case TWOLEVEL_GAP: return twoLevelGAp.predict(pc);
+  case TWOLEVEL_PAG: return twoLevelPAg.predict(pc);
+  case TWOLEVEL_PAP: return twoLevelPAp.predict(pc);
+  case TWOLEVEL_SAG: return twoLevelSAg.predict(pc);
+  case TWOLEVEL_SAS: return twoLevelSAs.predict(pc);
+  default: return NOTTAKEN;
   }
-
 }
 
-uint8_t custom_base_predict(uint32_t pc)
+uint8_t twolevel_confidence(uint64_t pc)
 {
-  // get lower bits of pc
-  uint32_t index = pc & (baseTableEntries - 1);
-  switch (base_bht_custom[index])
+  switch (twoLevelScheme)
   {
-  case WN:
-  case SN:
-    return NOTTAKEN;
-  case WT:
-  case ST:
-    return TAKEN;
-  default:
-    printf("Warning: Undefined state of entry in Base BHT!\n");
-    return NOTTAKEN;
+  case TWOLEVEL_GAG: return twoLevelGAg.confidence(pc);
+  case TWOLEVEL_GAP: return twoLevelGAp.confidence(pc);
+  case TWOLEVEL_PAG: return twoLevelPAg.confidence(pc);
+  case TWOLEVEL_PAP: return twoLevelPAp.confidence(pc);
+  case TWOLEVEL_SAG: return twoLevelSAg.confidence(pc);
+  case TWOLEVEL_SAS: return twoLevelSAs.confidence(pc);
+  default: return CONF_LOW;
   }
 }
 
-uint32_t computeIndex(uint32_t pc, tage_table *table)
+void train_twolevel(uint64_t pc, uint8_t outcome)
 {
-  uint32_t mask_out = (1 << table->historyBits) - 1;
-  uint32_t out_len = (uint32_t)log2(table->tableSize);
+  switch (twoLevelScheme)
+  {
+  case TWOLEVEL_GAG: twoLevelGAg.train(pc, outcome); break;
+  case TWOLEVEL_GAP: twoLevelGAp.train(pc, outcome); break;
+  case TWOLEVEL_PAG: twoLevelPAg.train(pc, outcome); break;
+  case TWOLEVEL_PAP: twoLevelPAp.train(pc, outcome); break;
+  case TWOLEVEL_SAG: twoLevelSAg.train(pc, outcome); break;
+  case TWOLEVEL_SAS: twoLevelSAs.train(pc, outcome); break;
+  default: break;
+  }
+}
 
-  uint32_t folded_history = 0;
-  for (int i = 0; i < table->historyBits; i += out_len)
+uint64_t twolevel_storage_bits()
+{
+  switch (twoLevelScheme)
   {
-    folded_history ^= (ghistory >> i) & mask_out;
+  case TWOLEVEL_GAG: return twoLevelGAg.storage_bits();
+  case TWOLEVEL_GAP: return twoLevelGAp.storage_bits();
+  case TWOLEVEL_PAG: return twoLevelPAg.storage_bits();
+  case TWOLEVEL_PAP: return twoLevelPAp.storage_bits();
+  case TWOLEVEL_SAG: return twoLevelSAg.storage_bits();
+  case TWOLEVEL_SAS: return twoLevelSAs.storage_bits();
+  default: return 0;
   }
+}
+
+
+
+
+// Custom Predictor functions (TAGE-SC-L)
+
+// Folded history functions
+
+void folded_init(folded_history *fold, uint32_t origLength, uint32_t compLength)
+{
+  fold->comp = 0;
+  fold->origLength = origLength;
+  fold->compLength = compLength;
+  fold->outpoint = (compLength > 0) ? origLength % compLength : 0;
+}
+
+// Fold in the newest history bit and drop the one that left the window.
+// 'history' is the circular buffer after the new bit was written at 'ptr'
+static inline void folded_update(folded_history *fold, const uint8_t *history, uint32_t ptr)
+{
+  if (fold->compLength == 0)
+    return;
+  fold->comp = (fold->comp << 1) ^ history[ptr & (TAGE_HIST_BUFFER - 1)];
+  fold->comp ^= history[(ptr + fold->origLength) & (TAGE_HIST_BUFFER - 1)] << fold->outpoint;
+  fold->comp ^= fold->comp >> fold->compLength;
+  fold->comp &= (1 << fold->compLength) - 1;
+}
+
+// Loop predictor functions
 
-  return (pc ^ folded_history) & mask_out;
+void init_loop(loop_predictor *lp, uint32_t logSets, uint32_t ways)
+{
+  lp->logSets = logSets;
+  lp->ways = ways;
+  lp->entries = (loop_entry *)calloc((1 << logSets) * ways, sizeof(loop_entry));
+  lp->withLoop = -1;
+}
+
+uint32_t loop_set(loop_predictor *lp, uint64_t pc)
+{
+  return ((pc ^ (pc >> lp->logSets)) & ((1 << lp->logSets) - 1)) * lp->ways;
 }
 
-uint32_t computeTag(uint32_t pc, tage_table *table)
+uint16_t loop_tag(loop_predictor *lp, uint64_t pc)
 {
-  uint32_t mask_out = (1 << table->numTagBits) - 1;
+  return (pc >> lp->logSets) & ((1 << LOOP_TAG_BITS) - 1);
+}
 
-  uint32_t folded_history = 0;
-  for (int i = 0; i < table->historyBits; i += table->numTagBits)
+// Return the matching entry, or NULL
+loop_entry *loop_lookup(loop_predictor *lp, uint64_t pc)
+{
+  loop_entry *set = &lp->entries[loop_set(lp, pc)];
+  uint16_t tag = loop_tag(lp, pc);
+  for (uint32_t way = 0; way < lp->ways; way++)
   {
-    folded_history ^= (ghistory >> i) & mask_out;
+    if (set[way].age > 0 && set[way].tag == tag)
+      return &set[way];
   }
+  return NULL;
+}
 
-  return (pc ^ folded_history) & mask_out;
+// Predict the next iteration of the loop at 'pc'. 'valid' is set when the
+// entry has seen the same trip count often enough to be trusted
+uint8_t loop_predict(loop_predictor *lp, uint64_t pc, uint8_t *valid)
+{
+  loop_entry *entry = loop_lookup(lp, pc);
+  *valid = (entry != NULL && entry->confidence == LOOP_CONF_MAX);
+  if (entry == NULL)
+    return NOTTAKEN;
+  if (entry->currentIter + 1 == entry->pastIter)
+    return !entry->dir;
+  return entry->dir;
 }
 
-uint8_t custom_tx_predict(uint32_t pc, tage_table *table)
+// Train the loop predictor; 'mispredicted' tells whether the prediction
+// that was finally used was wrong, which is when new loops are allocated
+void train_loop(loop_predictor *lp, uint64_t pc, uint8_t outcome, uint8_t mispredicted)
 {
-  uint32_t tag = (computeIndex(pc, table) ^ pc) & ((1 << table->numTagBits) - 1);
+  loop_entry *entry = loop_lookup(lp, pc);
 
-  for (int i = 0; i < table->tableSize; i++)
+  if (entry != NULL)
   {
-    if (table->tagTable[i].tag == tag)
+    uint8_t valid;
+    uint8_t prediction = loop_predict(lp, pc, &valid);
+    if (valid && prediction != outcome)
+    {
+      // The trip count changed, forget the loop
+      memset(entry, 0, sizeof(loop_entry));
+      return;
+    }
+    if (valid && entry->age < LOOP_AGE_MAX)
+      entry->age++;
+
+    entry->currentIter++;
+    if (entry->currentIter > LOOP_ITER_MAX)
+    {
+      // Too long to track
+      memset(entry, 0, sizeof(loop_entry));
+      return;
+    }
+    if (outcome != entry->dir)
     {
-      if (table->tagTable[i].ctr == WN || table->tagTable[i].ctr == SN)
+      // Loop exit
+      if (entry->currentIter == entry->pastIter)
       {
-        return NOTTAKEN;
+        if (entry->confidence < LOOP_CONF_MAX)
+          entry->confidence++;
       }
-      else 
+      else if (entry->pastIter == 0)
       {
-        return TAKEN;
+        entry->pastIter = entry->currentIter;
+      }
+      else
+      {
+        memset(entry, 0, sizeof(loop_entry));
+        return;
+      }
+      entry->currentIter = 0;
+    }
+  }
+  else if (mispredicted)
+  {
+    // Allocate over a free or aged out entry, otherwise age the set
+    loop_entry *set = &lp->entries[loop_set(lp, pc)];
+    for (uint32_t way = 0; way < lp->ways; way++)
+    {
+      if (set[way].age == 0)
+      {
+        set[way].tag = loop_tag(lp, pc);
+        set[way].pastIter = 0;
+        set[way].currentIter = 0;
+        set[way].confidence = 0;
+        set[way].age = LOOP_AGE_MAX;
+        set[way].dir = !outcome;
+        return;
       }
     }
+    for (uint32_t way = 0; way < lp->ways; way++)
+    {
+      set[way].age--;
+    }
   }
-  return NOTAPPLICABLE;
 }
 
+// Track whether overriding with the loop prediction helps
+void train_loop_usefulness(loop_predictor *lp, uint8_t loopPred, uint8_t otherPred, uint8_t outcome)
+{
+  if (loopPred == otherPred)
+    return;
+  if (loopPred == outcome && lp->withLoop < 63)
+    lp->withLoop++;
+  else if (loopPred != outcome && lp->withLoop > -64)
+    lp->withLoop--;
+}
 
-uint8_t custom_predict(uint32_t pc)
+uint64_t loop_storage_bits(loop_predictor *lp)
 {
-  uint8_t out = custom_base_predict(pc);
-  uint8_t t1Out = custom_tx_predict(pc, &tageTables[0]);
-  uint8_t t2Out = custom_tx_predict(pc, &tageTables[1]);
-  uint8_t t3Out = custom_tx_predict(pc, &tageTables[2]);
-  uint8_t t4Out = custom_tx_predict(pc, &tageTables[3]);
-  if (t4Out != NOTAPPLICABLE)
-  {
-    return t4Out;
-  }
-  else if (t3Out != NOTAPPLICABLE)
-  {
-    return t3Out;
-  }
-  else if (t2Out != NOTAPPLICABLE)
-  {
-    return t2Out;
-  }
-  else if (t1Out != NOTAPPLICABLE)
+  uint32_t entryBits = LOOP_TAG_BITS + 2 * LOOP_ITER_BITS + LOOP_CONF_BITS + LOOP_AGE_BITS + 1;
+  return (uint64_t)(1 << lp->logSets) * lp->ways * entryBits + 7;
+}
+
+void cleanup_loop(loop_predictor *lp)
+{
+  free(lp->entries);
+}
+
+// TAGE functions
+
+tage_table_entry tage_get_entry(tage_table *table, uint32_t idx)
+{
+  uint64_t raw = packed_get(&table->tagTable, idx);
+  tage_table_entry entry;
+  entry.tag = raw & ((1ULL << table->numTagBits) - 1);
+  entry.ctr = (raw >> TAGE_CTR_SHIFT(table)) & 0x7;
+  entry.useful = (raw >> TAGE_USEFUL_SHIFT(table)) & 0x3;
+  return entry;
+}
+
+void tage_set_entry(tage_table *table, uint32_t idx, tage_table_entry entry)
+{
+  uint64_t raw = ((uint64_t)entry.tag & ((1ULL << table->numTagBits) - 1)) |
+                 ((uint64_t)(entry.ctr & 0x7) << TAGE_CTR_SHIFT(table)) |
+                 ((uint64_t)(entry.useful & 0x3) << TAGE_USEFUL_SHIFT(table));
+  packed_set(&table->tagTable, idx, raw);
+}
+
+uint32_t computeIndex(uint64_t pc, tage_table *table)
+{
+  uint32_t pathLength = (table->historyBits < TAGE_PATH_BITS) ? table->historyBits : TAGE_PATH_BITS;
+  uint32_t path = tagePath & ((1 << pathLength) - 1);
+  path = (path & ((1 << table->logSize) - 1)) ^ (path >> table->logSize);
+  return (pc ^ (pc >> table->logSize) ^ table->indexFold.comp ^ path) & ((1 << table->logSize) - 1);
+}
+
+uint32_t computeTag(uint64_t pc, tage_table *table)
+{
+  uint32_t tag = pc ^ table->tagFold[0].comp ^ (table->tagFold[1].comp << 1);
+  return tag & ((1 << table->numTagBits) - 1);
+}
+
+uint8_t tage_base_predict(uint32_t index)
+{
+  return (packed_get(&tageBase, index) >= WT) ? TAKEN : NOTTAKEN;
+}
+
+void tage_lookup(uint64_t pc, tage_prediction *p)
+{
+  p->provider = -1;
+  p->alt = -1;
+  p->baseIndex = pc & ((1 << TAGE_BASE_BITS) - 1);
+
+  // Longest match provides, next longest is the alternate
+  tage_table_entry providerEntry = {0, 0, 0};
+  tage_table_entry altEntry = {0, 0, 0};
+  for (int i = TAGE_NUM_TABLES - 1; i >= 0; i--)
   {
-    return t1Out;
+    p->index[i] = computeIndex(pc, &tageTables[i]);
+    p->tag[i] = computeTag(pc, &tageTables[i]);
+    if (p->alt >= 0)
+      continue;
+    tage_table_entry entry = tage_get_entry(&tageTables[i], p->index[i]);
+    if (entry.tag != p->tag[i])
+      continue;
+    if (p->provider < 0)
+    {
+      p->provider = i;
+      providerEntry = entry;
+    }
+    else
+    {
+      p->alt = i;
+      altEntry = entry;
+    }
   }
-  else 
+
+  uint8_t basePred = tage_base_predict(p->baseIndex);
+  p->altPred = (p->alt >= 0) ? (altEntry.ctr >= 4) : basePred;
+  if (p->provider < 0)
   {
-    return out;
+    p->providerPred = basePred;
+    p->providerNew = 0;
+    uint8_t baseCtr = packed_get(&tageBase, p->baseIndex);
+    p->highConf = (baseCtr == SN || baseCtr == ST);
+    p->pred = basePred;
+    return;
   }
+
+  p->providerPred = (providerEntry.ctr >= 4);
+  p->providerNew = (providerEntry.ctr == 3 || providerEntry.ctr == 4) && providerEntry.useful == U0;
+  p->highConf = (providerEntry.ctr == 0 || providerEntry.ctr == TAGE_CTR_MAX);
+  p->pred = (p->providerNew && useAltOnNa >= 0) ? p->altPred : p->providerPred;
+}
+
+// Statistical corrector functions
+
+int32_t sc_get(sc_table *table, uint32_t idx)
+{
+  int32_t w = (int32_t)packed_get(&table->weights, idx);
+  return (w & (1 << (SC_WEIGHT_BITS - 1))) ? w - (1 << SC_WEIGHT_BITS) : w;
 }
 
-void train_custom_base(uint32_t pc, uint8_t outcome)
+void sc_train_weight(sc_table *table, uint32_t idx, uint8_t outcome)
 {
-  uint32_t index = pc & (baseTableEntries - 1);
-  switch (base_bht_custom[index])
-  {
-  case WN:
-    base_bht_custom[index] = (outcome == TAKEN) ? WT : SN;
-    break;
-  case SN:
-    base_bht_custom[index] = (outcome == TAKEN) ? WN : SN;
-    break;
-  case WT:
-    base_bht_custom[index] = (outcome == TAKEN) ? ST : WN;
-    break;
-  case ST:
-    base_bht_custom[index] = (outcome == TAKEN) ? ST : WT;
-    break;
-  default:
-    base_bht_custom[index] = WN;
-    printf("Warning: Undefined state of entry in BHT!\n");
-    break;
-  }
+  int32_t w = sc_get(table, idx);
+  if (outcome == TAKEN && w < SC_WEIGHT_MAX)
+    w++;
+  else if (outcome == NOTTAKEN && w > -SC_WEIGHT_MAX - 1)
+    w--;
+  packed_set(&table->weights, idx, (uint64_t)w);
+}
 
+uint32_t sc_bias_index(uint64_t pc, tage_prediction *p)
+{
+  return ((pc << 2) | (p->pred << 1) | p->highConf) & ((1 << (SC_LOG + 1)) - 1);
 }
 
-uint8_t addNewEntry(uint32_t pc, uint8_t outcome, tage_table *table)
+uint32_t sc_index(uint64_t pc, sc_table *table)
 {
-  // get lower historyBits of pc
-  uint32_t idx;
-  uint32_t ghistory_lower_bits;
-  uint32_t folded_history;
-  uint32_t index;
-  uint32_t tag;
-  uint8_t tableFound = 0;
+  return (pc ^ (pc >> SC_LOG) ^ table->fold.comp) & ((1 << SC_LOG) - 1);
+}
 
-  ghistory_lower_bits = ghistory & ((1 << table->historyBits) - 1);
-  folded_history = 0;
-  for (int i = 0; i < table->historyBits; i += log2(table->tableSize))
+// Sum of the centered corrector weights, positive means taken
+int32_t sc_sum(uint64_t pc, tage_prediction *p)
+{
+  int32_t sum = 2 * sc_get(&scBias, sc_bias_index(pc, p)) + 1;
+  for (int i = 0; i < SC_NUM_TABLES; i++)
   {
-    folded_history ^= (ghistory_lower_bits >> i);
+    sum += 2 * sc_get(&scTables[i], sc_index(pc, &scTables[i])) + 1;
   }
+  return sum;
+}
 
-  index = (pc ^ folded_history);
-  tag = index & ((1 << table->numTagBits) - 1);
+// The corrector reverts TAGE only when it is confident enough; a
+// saturated TAGE provider needs twice the confidence
+uint8_t sc_predict(int32_t sum, tage_prediction *p)
+{
+  uint8_t scPred = (sum >= 0) ? TAKEN : NOTTAKEN;
+  int32_t threshold = p->highConf ? 2 * scThreshold : scThreshold;
+  return (scPred != p->pred && abs(sum) >= threshold) ? scPred : p->pred;
+}
+
+void train_sc(uint64_t pc, tage_prediction *p, int32_t sum, uint8_t outcome)
+{
+  uint8_t scPred = (sum >= 0) ? TAKEN : NOTTAKEN;
+  if (scPred == outcome && abs(sum) >= scThreshold)
+    return;
 
-  // First try to add data in the last table
-  for (idx = 0; idx < table->tableSize; idx++)
+  // Adapt the threshold as in O-GEHL
+  if (scPred != outcome)
   {
-    if (table->tagTable[idx].useful == U0)
+    if (++scThresholdCounter >= 32)
     {
-      table->tagTable[idx].useful++;
-
-      // Allocate entry
-      table->tagTable[idx].tag = tag;
-      table->tagTable[idx].ctr = (outcome == TAKEN) ? WT : WN;
-      tableFound = 1;
-      break;
+      scThreshold++;
+      scThresholdCounter = 0;
     }
   }
-  if (!tableFound)
+  else if (--scThresholdCounter <= -32)
   {
-    // First try to add data in the last table
-    for (idx = 0; idx < table->tableSize; idx++)
-    {
-      if (table->tagTable[idx].useful == U1)
-      {
-        // Allocate entry
-        table->tagTable[idx].tag = tag;
-        table->tagTable[idx].ctr = (outcome == TAKEN) ? WT : WN;
-        tableFound = 1;
-        break;
-      }
-    }
+    if (scThreshold > 1)
+      scThreshold--;
+    scThresholdCounter = 0;
   }
 
-  return tableFound;
+  sc_train_weight(&scBias, sc_bias_index(pc, p), outcome);
+  for (int i = 0; i < SC_NUM_TABLES; i++)
+  {
+    sc_train_weight(&scTables[i], sc_index(pc, &scTables[i]), outcome);
+  }
 }
 
-uint8_t deleteEntry(uint32_t pc, tage_table *table)
+void init_custom()
 {
-  // get lower historyBits of pc
-  uint32_t idx;
-  uint32_t ghistory_lower_bits;
-  uint32_t folded_history;
-  uint32_t index;
-  uint32_t tag;
-  uint8_t tableFound = 0;
+  packed_init(&tageBase, 1 << TAGE_BASE_BITS, 2, WN);
 
-  ghistory_lower_bits = ghistory & ((1 << table->historyBits) - 1);
-  folded_history = 0;
-  for (int i = 0; i < table->historyBits; i += log2(table->tableSize))
+  tage_table_entry empty = {.tag = 0, .ctr = 3, .useful = U0};
+  for (int idx = 0; idx < TAGE_NUM_TABLES; idx++)
   {
-    folded_history ^= (ghistory_lower_bits >> i);
+    tage_table *table = &tageTables[idx];
+    packed_init(&table->tagTable, 1 << table->logSize, TAGE_ENTRY_BITS(table), 0);
+    for (uint32_t i = 0; i < (1u << table->logSize); i++)
+    {
+      tage_set_entry(table, i, empty);
+    }
+    folded_init(&table->indexFold, table->historyBits, table->logSize);
+    folded_init(&table->tagFold[0], table->historyBits, table->numTagBits);
+    folded_init(&table->tagFold[1], table->historyBits, table->numTagBits - 1);
   }
 
-  index = (pc ^ folded_history);
-  tag = index & ((1 << table->numTagBits) - 1);
-
-  for (idx = 0; idx < table->tableSize; idx++)
+  packed_init(&scBias.weights, 1 << (SC_LOG + 1), SC_WEIGHT_BITS, 0);
+  for (int i = 0; i < SC_NUM_TABLES; i++)
   {
-    if (table->tagTable[idx].tag == tag)
-    {
-      table->tagTable[idx].useful = U0;
-
-      // Allocate entry
-      table->tagTable[idx].tag = 0xFFFFFFFF;
-      table->tagTable[idx].ctr = WN;
-      tableFound = 1;
-      break;
-    }
+    packed_init(&scTables[i].weights, 1 << SC_LOG, SC_WEIGHT_BITS, 0);
+    folded_init(&scTables[i].fold, scTables[i].historyBits, SC_LOG);
   }
-  return tableFound;
+  scThreshold = 35;
+  scThresholdCounter = 0;
+
+  init_loop(&tageLoop, 3, 4);
+
+  memset(tageHistory, 0, sizeof(tageHistory));
+  tageHistoryPtr = 0;
+  tagePath = 0;
+  useAltOnNa = 0;
+  tageTick = 0;
+  tageAllocSeed = 0;
 }
 
-uint8_t train_custom_tx(uint32_t pc, uint8_t outcome, tage_table *table)
+uint8_t custom_predict(uint64_t pc)
 {
-  uint32_t idx;
-  uint8_t tagFound = 0;
-  // get lower historyBits of pc
-  uint32_t ghistory_lower_bits = ghistory & ((1 << table->historyBits) - 1);
-  uint32_t folded_history = 0;
-  for (int i = 0; i < table->historyBits; i += log2(table->tableSize))
+  tage_prediction p;
+  tage_lookup(pc, &p);
+  uint8_t prediction = sc_predict(sc_sum(pc, &p), &p);
+
+  uint8_t loopValid;
+  uint8_t loopPred = loop_predict(&tageLoop, pc, &loopValid);
+  if (loopValid && tageLoop.withLoop >= 0)
   {
-    folded_history ^= (ghistory_lower_bits >> i);
+    return loopPred;
   }
+  return prediction;
+}
 
-  uint32_t index = (pc ^ folded_history);
-  uint32_t tag = index & ((1 << table->numTagBits) - 1);
+// High for a confident loop prediction or a saturated provider, medium
+// for a provider one step from saturation, low for a weak provider or
+// when the statistical corrector reverted TAGE
+uint8_t custom_confidence(uint64_t pc)
+{
+  uint8_t loopValid;
+  loop_predict(&tageLoop, pc, &loopValid);
+  if (loopValid && tageLoop.withLoop >= 0)
+  {
+    return CONF_HIGH;
+  }
 
-  for (idx = 0; idx < table->tableSize; idx++)
+  tage_prediction p;
+  tage_lookup(pc, &p);
+  if (sc_predict(sc_sum(pc, &p), &p) != p.pred)
   {
-    if (table->tagTable[idx].tag == tag)
-    {
-      tagFound = 1;
-      // Update state of entry in bht based on outcome
-      switch (table->tagTable[idx].ctr)
-      {
-      case WN:
-        table->tagTable[idx].ctr = (outcome == TAKEN) ? WT : SN;
-        break;
-      case SN:
-        table->tagTable[idx].ctr = (outcome == TAKEN) ? WN : SN;
-        break;
-      case WT:
-        table->tagTable[idx].ctr = (outcome == TAKEN) ? ST : WN;
-        break;
-      case ST:
-        table->tagTable[idx].ctr = (outcome == TAKEN) ? ST : WT;
-        break;
-      default:
-        printf("Warning: Undefined state of entry in TX BHT!\n");
-        break;
-      }
-      break;
-    }
+    return CONF_LOW;
+  }
+  if (p.provider < 0)
+  {
+    return counter_confidence(packed_get(&tageBase, p.baseIndex), 2);
+  }
+  if (p.pred != p.providerPred)
+  {
+    return CONF_LOW;
   }
-  return tagFound;
+  return counter_confidence(tage_get_entry(&tageTables[p.provider], p.index[p.provider]).ctr, 3);
 }
 
-void train_custom(uint32_t pc, uint8_t outcome)
+// Allocate an entry in a table with longer history than the provider
+void tage_allocate(tage_prediction *p, uint8_t outcome)
 {
-  uint8_t tableFound;
-  uint8_t t0Out = custom_tx_predict(pc, &tageTables[0]);
-  uint8_t t1Out = custom_tx_predict(pc, &tageTables[1]);
-  uint8_t t2Out = custom_tx_predict(pc, &tageTables[2]);
-  uint8_t t3Out = custom_tx_predict(pc, &tageTables[3]);
-  uint8_t baseOut = custom_base_predict(pc);
+  int start = p->provider + 1;
+  if (start >= TAGE_NUM_TABLES)
+    return;
 
-  //uint8_t t1Out = train_custom_tx(pc, outcome, &tageTables[0]);
-  //uint8_t t2Out = train_custom_tx(pc, outcome, &tageTables[1]);
-  //uint8_t t3Out = train_custom_tx(pc, outcome, &tageTables[2]);
-  //uint8_t t4Out = train_custom_tx(pc, outcome, &tageTables[3]);
+  // Occasionally skip a table so allocations spread over the longer ones
+  tageAllocSeed = tageAllocSeed * 1103515245 + 12345;
+  if (start + 1 < TAGE_NUM_TABLES && ((tageAllocSeed >> 16) & 3) == 0)
+    start++;
 
-
-  if ((t0Out != outcome) &&
-      (t1Out != outcome) &&
-      (t2Out != outcome) &&
-      (t3Out != outcome) &&
-      (baseOut != outcome))
+  for (int i = start; i < TAGE_NUM_TABLES; i++)
   {
-    if (baseOut != NOTAPPLICABLE)
-    {
-      tableFound = addNewEntry(pc, outcome, &tageTables[0]);
-    }
-    // This branch data is not there in any table, add to first table
-    if (t0Out != NOTAPPLICABLE)
-    {
-      tableFound = addNewEntry(pc, outcome, &tageTables[1]);
-      deleteEntry(pc, &tageTables[0]);
-    }
-    else if (t1Out != NOTAPPLICABLE)
-    {
-      tableFound = addNewEntry(pc, outcome, &tageTables[2]);
-      deleteEntry(pc, &tageTables[1]);
-    }
-    else if (t2Out != NOTAPPLICABLE)
+    tage_table_entry entry = tage_get_entry(&tageTables[i], p->index[i]);
+    if (entry.useful == U0)
     {
-      tableFound = addNewEntry(pc, outcome, &tageTables[3]);
-      deleteEntry(pc, &tageTables[2]);
+      entry.tag = p->tag[i];
+      entry.ctr = (outcome == TAKEN) ? 4 : 3;
+      tage_set_entry(&tageTables[i], p->index[i], entry);
+      return;
     }
-    else if (t3Out != NOTAPPLICABLE)
-    {
-      tableFound = addNewEntry(pc, outcome, &tageTables[3]);
+  }
 
-    }
+  // Every candidate is useful, make room for later allocations
+  for (int i = start; i < TAGE_NUM_TABLES; i++)
+  {
+    tage_table_entry entry = tage_get_entry(&tageTables[i], p->index[i]);
+    entry.useful--;
+    tage_set_entry(&tageTables[i], p->index[i], entry);
   }
-  else 
+}
+
+void train_tage_ctr(tage_table *table, uint32_t idx, uint8_t outcome)
+{
+  tage_table_entry entry = tage_get_entry(table, idx);
+  if (outcome == TAKEN && entry.ctr < TAGE_CTR_MAX)
+    entry.ctr++;
+  else if (outcome == NOTTAKEN && entry.ctr > 0)
+    entry.ctr--;
+  tage_set_entry(table, idx, entry);
+}
+
+void train_tage_base(uint32_t idx, uint8_t outcome)
+{
+  uint8_t ctr = packed_get(&tageBase, idx);
+  if (outcome == TAKEN && ctr < ST)
+    ctr++;
+  else if (outcome == NOTTAKEN && ctr > SN)
+    ctr--;
+  packed_set(&tageBase, idx, ctr);
+}
+
+// Age every useful counter so stale entries can be replaced
+void tage_age_useful()
+{
+  for (int i = 0; i < TAGE_NUM_TABLES; i++)
   {
-    if (t3Out == outcome)
+    for (uint32_t idx = 0; idx < (1u << tageTables[i].logSize); idx++)
     {
-      train_custom_tx(pc, outcome, &tageTables[3]);
-      deleteEntry(pc, &tageTables[2]);
-      deleteEntry(pc, &tageTables[1]);
-      deleteEntry(pc, &tageTables[0]);
+      tage_table_entry entry = tage_get_entry(&tageTables[i], idx);
+      if (entry.useful != U0)
+      {
+        entry.useful >>= 1;
+        tage_set_entry(&tageTables[i], idx, entry);
+      }
     }
-    else if (t2Out == outcome)
-    {
-      train_custom_tx(pc, outcome, &tageTables[2]);
-      deleteEntry(pc, &tageTables[1]);
-      deleteEntry(pc, &tageTables[0]);
+  }
+}
 
-    }
-    else if (t1Out == outcome)
+void train_tage(tage_prediction *p, uint8_t outcome)
+{
+  if (p->provider >= 0)
+  {
+    // Learn whether newly allocated providers should be trusted
+    if (p->providerNew && p->providerPred != p->altPred)
     {
-      train_custom_tx(pc, outcome, &tageTables[1]);
-      deleteEntry(pc, &tageTables[0]);
+      if (p->altPred == outcome && useAltOnNa < 7)
+        useAltOnNa++;
+      else if (p->altPred != outcome && useAltOnNa > -8)
+        useAltOnNa--;
     }
-    else if (t0Out == outcome)
+
+    tage_table *provider = &tageTables[p->provider];
+    tage_table_entry entry = tage_get_entry(provider, p->index[p->provider]);
+    if (p->providerPred != p->altPred)
     {
-      train_custom_tx(pc, outcome, &tageTables[0]);
+      if (p->providerPred == outcome && entry.useful < U3)
+        entry.useful++;
+      else if (p->providerPred != outcome && entry.useful > U0)
+        entry.useful--;
+      tage_set_entry(provider, p->index[p->provider], entry);
     }
-    else if (baseOut == outcome)
+
+    // A provider that is not yet useful also trains the alternate
+    if (entry.useful == U0)
     {
-      train_custom_base(pc, outcome);
+      if (p->alt >= 0)
+        train_tage_ctr(&tageTables[p->alt], p->index[p->alt], outcome);
+      else
+        train_tage_base(p->baseIndex, outcome);
     }
+    train_tage_ctr(provider, p->index[p->provider], outcome);
+  }
+  else
+  {
+    train_tage_base(p->baseIndex, outcome);
+  }
+
+  if (p->pred != outcome)
+  {
+    tage_allocate(p, outcome);
+  }
+
+  if (++tageTick >= TAGE_USEFUL_RESET_PERIOD)
+  {
+    tage_age_useful();
+    tageTick = 0;
   }
-  ghistory = ((ghistory << 1) | outcome);
 }
 
-void cleanup_custom()
+void update_tage_history(uint64_t pc, uint8_t outcome)
 {
-  free(base_bht_custom);
-  free(tageTables[0].tagTable);
-  free(tageTables[1].tagTable);
-  free(tageTables[2].tagTable);
-  free(tageTables[3].tagTable);
+  tageHistoryPtr = (tageHistoryPtr - 1) & (TAGE_HIST_BUFFER - 1);
+  tageHistory[tageHistoryPtr] = outcome;
+  for (int i = 0; i < TAGE_NUM_TABLES; i++)
+  {
+    folded_update(&tageTables[i].indexFold, tageHistory, tageHistoryPtr);
+    folded_update(&tageTables[i].tagFold[0], tageHistory, tageHistoryPtr);
+    folded_update(&tageTables[i].tagFold[1], tageHistory, tageHistoryPtr);
+  }
+  for (int i = 0; i < SC_NUM_TABLES; i++)
+  {
+    folded_update(&scTables[i].fold, tageHistory, tageHistoryPtr);
+  }
+  tagePath = ((tagePath << 1) ^ ((pc ^ (pc >> 2)) & 1)) & ((1 << TAGE_PATH_BITS) - 1);
 }
 
-void init_predictor()
+void train_custom_loop(uint64_t pc, uint8_t outcome)
 {
-  switch (bpType)
+  tage_prediction p;
+  tage_lookup(pc, &p);
+  uint8_t scPred = sc_predict(sc_sum(pc, &p), &p);
+
+  uint8_t loopValid;
+  uint8_t loopPred = loop_predict(&tageLoop, pc, &loopValid);
+  uint8_t prediction = (loopValid && tageLoop.withLoop >= 0) ? loopPred : scPred;
+  if (loopValid)
   {
-  case STATIC:
-    break;
-  case GSHARE:
-    init_gshare();
-    break;
-  case TOURNAMENT:
-    init_tournament();
-    break;
-  case CUSTOM:
-    init_custom();
-    break;
-  default:
-    break;
+    train_loop_usefulness(&tageLoop, loopPred, scPred, outcome);
   }
+  train_loop(&tageLoop, pc, outcome, prediction != outcome);
 }
 
-// Make a prediction for conditional branch instruction at PC 'pc'
-// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
-// indicates a prediction of not taken
-//
-uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
+// Train TAGE and the statistical corrector; the loop predictor is trained
+// separately by train_custom_loop
+void train_custom(uint64_t pc, uint8_t outcome)
 {
+  tage_prediction p;
+  tage_lookup(pc, &p);
+  int32_t sum = sc_sum(pc, &p);
 
-  // Make a prediction based on the bpType
-  switch (bpType)
+  train_sc(pc, &p, sum, outcome);
+  train_tage(&p, outcome);
+  update_tage_history(pc, outcome);
+}
+
+uint64_t custom_storage_bits()
+{
+  uint64_t bits = packed_bits(&tageBase);
+  for (int i = 0; i < TAGE_NUM_TABLES; i++)
   {
-  case STATIC:
-    return TAKEN;
-  case GSHARE:
-    return gshare_predict(pc);
-  case TOURNAMENT:
-    return tournament_predict(pc);
-  case CUSTOM:
-    return custom_predict(pc);
-  default:
-    break;
+    bits += packed_bits(&tageTables[i].tagTable);
+    // Folded history registers
+    bits += tageTables[i].indexFold.compLength + tageTables[i].tagFold[0].compLength + tageTables[i].tagFold[1].compLength;
+  }
+  bits += packed_bits(&scBias.weights);
+  for (int i = 0; i < SC_NUM_TABLES; i++)
+  {
+    bits += packed_bits(&scTables[i].weights) + scTables[i].fold.compLength;
+  }
+  bits += loop_storage_bits(&tageLoop);
+  // Global and path history, USE_ALT_ON_NA, useful reset tick, SC threshold and counter
+  bits += TAGE_MAX_HISTORY + TAGE_PATH_BITS + 4 + 18 + 8 + 6;
+  return bits;
+}
+
+void cleanup_custom()
+{
+  packed_free(&tageBase);
+  for (int i = 0; i < TAGE_NUM_TABLES; i++)
+  {
+    packed_free(&tageTables[i].tagTable);
+  }
+  packed_free(&scBias.weights);
+  for (int i = 0; i < SC_NUM_TABLES; i++)
+  {
+    packed_free(&scTables[i].weights);
+  }
+  cleanup_loop(&tageLoop);
+}
+
+// Perceptron predictor functions
+
+// Dot product and training kernels. Inputs are +1, -1 or 0 (padding), so
+// the product w * x is just w with its sign flipped or cleared. Weights are
+// kept in the symmetric range [-maxWeight, maxWeight] so that flipping the
+// sign of an int8 weight never overflows.
+
+int32_t perceptron_dot_scalar(const int8_t *weights, const int8_t *inputs, uint32_t n)
+{
+  int32_t sum = 0;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    sum += weights[i] * inputs[i];
+  }
+  return sum;
+}
+
+void perceptron_train_scalar(int8_t *weights, const int8_t *inputs, uint32_t n, uint8_t outcome, int8_t maxWeight)
+{
+  for (uint32_t i = 0; i < n; i++)
+  {
+    int32_t w = weights[i] + ((outcome == TAKEN) ? inputs[i] : -inputs[i]);
+    if (w > maxWeight)
+      w = maxWeight;
+    if (w < -maxWeight)
+      w = -maxWeight;
+    weights[i] = (int8_t)w;
+  }
+}
+
+#ifdef PREDICTOR_X86_SIMD
+__attribute__((target("sse4.1")))
+int32_t perceptron_dot_sse(const int8_t *weights, const int8_t *inputs, uint32_t n)
+{
+  const __m128i ones8 = _mm_set1_epi8(1);
+  const __m128i ones16 = _mm_set1_epi16(1);
+  __m128i acc = _mm_setzero_si128();
+  for (uint32_t i = 0; i < n; i += 16)
+  {
+    __m128i w = _mm_loadu_si128((const __m128i *)(weights + i));
+    __m128i x = _mm_loadu_si128((const __m128i *)(inputs + i));
+    __m128i prod = _mm_sign_epi8(w, x);
+    __m128i pairs = _mm_maddubs_epi16(ones8, prod);
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(pairs, ones16));
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("sse4.1")))
+void perceptron_train_sse(int8_t *weights, const int8_t *inputs, uint32_t n, uint8_t outcome, int8_t maxWeight)
+{
+  const __m128i hi = _mm_set1_epi8(maxWeight);
+  const __m128i lo = _mm_set1_epi8(-maxWeight);
+  for (uint32_t i = 0; i < n; i += 16)
+  {
+    __m128i w = _mm_loadu_si128((const __m128i *)(weights + i));
+    __m128i x = _mm_loadu_si128((const __m128i *)(inputs + i));
+    w = (outcome == TAKEN) ? _mm_adds_epi8(w, x) : _mm_subs_epi8(w, x);
+    w = _mm_min_epi8(_mm_max_epi8(w, lo), hi);
+    _mm_storeu_si128((__m128i *)(weights + i), w);
+  }
+}
+
+__attribute__((target("avx2")))
+int32_t perceptron_dot_avx2(const int8_t *weights, const int8_t *inputs, uint32_t n)
+{
+  const __m256i ones8 = _mm256_set1_epi8(1);
+  const __m256i ones16 = _mm256_set1_epi16(1);
+  __m256i acc = _mm256_setzero_si256();
+  for (uint32_t i = 0; i < n; i += 32)
+  {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(weights + i));
+    __m256i x = _mm256_loadu_si256((const __m256i *)(inputs + i));
+    __m256i prod = _mm256_sign_epi8(w, x);
+    __m256i pairs = _mm256_maddubs_epi16(ones8, prod);
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones16));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2")))
+void perceptron_train_avx2(int8_t *weights, const int8_t *inputs, uint32_t n, uint8_t outcome, int8_t maxWeight)
+{
+  const __m256i hi = _mm256_set1_epi8(maxWeight);
+  const __m256i lo = _mm256_set1_epi8(-maxWeight);
+  for (uint32_t i = 0; i < n; i += 32)
+  {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(weights + i));
+    __m256i x = _mm256_loadu_si256((const __m256i *)(inputs + i));
+    w = (outcome == TAKEN) ? _mm256_adds_epi8(w, x) : _mm256_subs_epi8(w, x);
+    w = _mm256_min_epi8(_mm256_max_epi8(w, lo), hi);
+    _mm256_storeu_si256((__m256i *)(weights + i), w);
+  }
+}
+#endif
+
+#ifdef PREDICTOR_X86_SIMD
+#define SIMD_NONE 0
+#define SIMD_SSE41 1
+#define SIMD_AVX2 2
+
+// The widest SIMD level the host supports, read with cpuid rather than
+// __builtin_cpu_supports, whose runtime lives in libgcc and is missing
+// from the Pin CRT that branchExt -predict links against
+int host_simd_level()
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+  {
+    return SIMD_NONE;
+  }
+  int level = (ecx & bit_SSE4_1) ? SIMD_SSE41 : SIMD_NONE;
+
+  // AVX2 also needs the OS to save the YMM registers (XCR0 bits 1 and 2)
+  if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX) && __get_cpuid_max(0, NULL) >= 7)
+  {
+    uint32_t xcr0, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if ((xcr0 & 0x6) == 0x6 && (ebx & bit_AVX2))
+    {
+      level = SIMD_AVX2;
+    }
+  }
+  return level;
+}
+#endif
+
+// Pick the widest kernels the host supports
+void select_perceptron_kernels()
+{
+  perceptron_dot = perceptron_dot_scalar;
+  perceptron_train = perceptron_train_scalar;
+#ifdef PREDICTOR_X86_SIMD
+  int level = host_simd_level();
+  if (level == SIMD_AVX2)
+  {
+    perceptron_dot = perceptron_dot_avx2;
+    perceptron_train = perceptron_train_avx2;
+  }
+  else if (level == SIMD_SSE41)
+  {
+    perceptron_dot = perceptron_dot_sse;
+    perceptron_train = perceptron_train_sse;
+  }
+#endif
+}
+
+void init_perceptron()
+{
+  uint32_t inputs = perceptronHistoryBits + 1; // history bits plus bias
+  perceptronStride = (inputs + PERCEPTRON_VECTOR_ALIGN - 1) / PERCEPTRON_VECTOR_ALIGN * PERCEPTRON_VECTOR_ALIGN;
+  perceptronWeights = (int8_t *)calloc((size_t)perceptronEntries * perceptronStride, sizeof(int8_t));
+  perceptronInputs = (int8_t *)calloc(perceptronStride, sizeof(int8_t));
+  perceptronTheta = (int32_t)(1.93 * perceptronHistoryBits + 14);
+  perceptronMaxWeight = (int8_t)((1 << (perceptronWeightBits - 1)) - 1);
+
+  // Bias input is always 1, history starts as all not taken
+  perceptronInputs[0] = 1;
+  for (uint32_t i = 1; i < inputs; i++)
+  {
+    perceptronInputs[i] = -1;
+  }
+  select_perceptron_kernels();
+}
+
+int8_t *perceptron_weights(uint64_t pc)
+{
+  return perceptronWeights + (size_t)(pc % perceptronEntries) * perceptronStride;
+}
+
+uint8_t perceptron_predict(uint64_t pc)
+{
+  int32_t y = perceptron_dot(perceptron_weights(pc), perceptronInputs, perceptronStride);
+  return (y >= 0) ? TAKEN : NOTTAKEN;
+}
+
+uint8_t perceptron_confidence(uint64_t pc)
+{
+  return output_confidence(perceptron_dot(perceptron_weights(pc), perceptronInputs, perceptronStride), perceptronTheta);
+}
+
+// Update history register, most recent outcome first
+void update_perceptron_history(uint8_t outcome)
+{
+  memmove(perceptronInputs + 2, perceptronInputs + 1, perceptronHistoryBits - 1);
+  perceptronInputs[1] = (outcome == TAKEN) ? 1 : -1;
+}
+
+void train_perceptron(uint64_t pc, uint8_t outcome)
+{
+  int8_t *weights = perceptron_weights(pc);
+  int32_t y = perceptron_dot(weights, perceptronInputs, perceptronStride);
+  uint8_t prediction = (y >= 0) ? TAKEN : NOTTAKEN;
+
+  // Train on a misprediction or when the output is not confident enough
+  if (prediction != outcome || abs(y) <= perceptronTheta)
+  {
+    perceptron_train(weights, perceptronInputs, perceptronStride, outcome, perceptronMaxWeight);
+  }
+
+  update_perceptron_history(outcome);
+}
+
+uint64_t perceptron_storage_bits()
+{
+  return (uint64_t)perceptronEntries * (perceptronHistoryBits + 1) * perceptronWeightBits + perceptronHistoryBits;
+}
+
+void cleanup_perceptron()
+{
+  free(perceptronWeights);
+  free(perceptronInputs);
+}
+
+// Hashed perceptron functions
+
+// Sum the selected weights. The AVX2 kernel gathers eight weights at a time;
+// each lane loads 32 bits at a byte offset and keeps the sign extended low byte,
+// which is why the weight array carries a few bytes of trailing padding.
+
+int32_t hashed_sum_scalar(const int8_t *weights, const int32_t *index, uint32_t n)
+{
+  int32_t sum = 0;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    sum += weights[index[i]];
+  }
+  return sum;
+}
+
+#ifdef PREDICTOR_X86_SIMD
+__attribute__((target("avx2")))
+int32_t hashed_sum_avx2(const int8_t *weights, const int32_t *index, uint32_t n)
+{
+  __m256i acc = _mm256_setzero_si256();
+  for (uint32_t i = 0; i < n; i += 8)
+  {
+    __m256i offsets = _mm256_loadu_si256((const __m256i *)(index + i));
+    __m256i raw = _mm256_i32gather_epi32((const int *)weights, offsets, 1);
+    acc = _mm256_add_epi32(acc, _mm256_srai_epi32(_mm256_slli_epi32(raw, 24), 24));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+// Read 'length' (at most 64) bits of a multi-word history starting at bit 'start'
+uint64_t history_bits(const uint64_t *history, uint32_t words, uint32_t start, uint32_t length)
+{
+  uint32_t word = start >> 6;
+  uint32_t shift = start & 63;
+  if (word >= words)
+    return 0;
+  uint64_t value = history[word] >> shift;
+  if (shift != 0 && word + 1 < words)
+    value |= history[word + 1] << (64 - shift);
+  return (length == 64) ? value : value & ((1ULL << length) - 1);
+}
+
+// XOR-fold bits [start, start + length) of a multi-word history to 'outBits'
+uint32_t fold_history(const uint64_t *history, uint32_t words, uint32_t start, uint32_t length, uint32_t outBits)
+{
+  uint32_t folded = 0;
+  for (uint32_t i = 0; i < length; i += outBits)
+  {
+    uint32_t chunk = (length - i < outBits) ? length - i : outBits;
+    folded ^= (uint32_t)history_bits(history, words, start + i, chunk);
+  }
+  return folded;
+}
+
+void init_hashed()
+{
+  uint32_t tableEntries = 1 << hashedTableBits;
+  uint32_t tableArea = HP_NUM_FEATURES * tableEntries;
+  // Padding lanes point at a zero weight just past the tables
+  hpWeights = (int8_t *)calloc(tableArea + 8, sizeof(int8_t));
+  hpIndexCount = (HP_NUM_FEATURES + 7) / 8 * 8;
+  hpIndex = (int32_t *)malloc(hpIndexCount * sizeof(int32_t));
+  for (uint32_t i = 0; i < hpIndexCount; i++)
+  {
+    hpIndex[i] = tableArea;
+  }
+  memset(hpHistory, 0, sizeof(hpHistory));
+  hpPath = 0;
+  packed_init(&hpLocalHistory, HP_LOCAL_ENTRIES, HP_LOCAL_BITS, 0);
+  hpTheta = (int32_t)(2.14 * HP_NUM_FEATURES + 20.58);
+  hpThresholdCounter = 0;
+  hpMaxWeight = (int8_t)((1 << (hashedWeightBits - 1)) - 1);
+
+  hashed_sum = hashed_sum_scalar;
+#ifdef PREDICTOR_X86_SIMD
+  if (host_simd_level() == SIMD_AVX2)
+  {
+    hashed_sum = hashed_sum_avx2;
+  }
+#endif
+}
+
+// Compute the weight offset selected by every feature for this branch
+void hashed_compute_index(uint64_t pc)
+{
+  uint32_t mask = (1 << hashedTableBits) - 1;
+  uint32_t pcHash = (pc ^ (pc >> hashedTableBits)) & mask;
+  uint64_t local = packed_get(&hpLocalHistory, pc & (HP_LOCAL_ENTRIES - 1));
+
+  for (uint32_t i = 0; i < HP_NUM_FEATURES; i++)
+  {
+    hp_feature *feature = &hpFeatures[i];
+    uint32_t hash;
+    switch (feature->type)
+    {
+    case HP_GHIST:
+      hash = fold_history(hpHistory, HP_HISTORY_WORDS, feature->start, feature->length, hashedTableBits) ^ pcHash;
+      break;
+    case HP_PATH:
+      hash = fold_history(&hpPath, 1, feature->start, feature->length, hashedTableBits) ^ pcHash;
+      break;
+    case HP_LOCAL:
+      hash = fold_history(&local, 1, feature->start, feature->length, hashedTableBits) ^ pcHash;
+      break;
+    case HP_PC:
+    {
+      uint64_t pcBits = pc;
+      hash = fold_history(&pcBits, 1, feature->start, feature->length, hashedTableBits);
+      break;
+    }
+    case HP_BIAS:
+    default:
+      hash = pcHash;
+      break;
+    }
+    hpIndex[i] = (i << hashedTableBits) + (hash & mask);
+  }
+}
+
+uint8_t hashed_predict(uint64_t pc)
+{
+  hashed_compute_index(pc);
+  int32_t y = hashed_sum(hpWeights, hpIndex, hpIndexCount);
+  return (y >= 0) ? TAKEN : NOTTAKEN;
+}
+
+uint8_t hashed_confidence(uint64_t pc)
+{
+  hashed_compute_index(pc);
+  return output_confidence(hashed_sum(hpWeights, hpIndex, hpIndexCount), hpTheta);
+}
+
+// Shift a branch into the global and path histories
+void update_hashed_history(uint64_t pc, uint8_t outcome)
+{
+  for (int i = HP_HISTORY_WORDS - 1; i > 0; i--)
+  {
+    hpHistory[i] = (hpHistory[i] << 1) | (hpHistory[i - 1] >> 63);
+  }
+  hpHistory[0] = (hpHistory[0] << 1) | outcome;
+  hpPath = (hpPath << HP_PATH_BITS) | (pc & ((1 << HP_PATH_BITS) - 1));
+}
+
+void update_hashed_local_history(uint64_t pc, uint8_t outcome)
+{
+  uint32_t localIndex = pc & (HP_LOCAL_ENTRIES - 1);
+  packed_set(&hpLocalHistory, localIndex, (packed_get(&hpLocalHistory, localIndex) << 1) | outcome);
+}
+
+void train_hashed(uint64_t pc, uint8_t outcome)
+{
+  hashed_compute_index(pc);
+  int32_t y = hashed_sum(hpWeights, hpIndex, hpIndexCount);
+  uint8_t prediction = (y >= 0) ? TAKEN : NOTTAKEN;
+
+  if (prediction != outcome || abs(y) <= hpTheta)
+  {
+    for (uint32_t i = 0; i < HP_NUM_FEATURES; i++)
+    {
+      int8_t *w = &hpWeights[hpIndex[i]];
+      if (outcome == TAKEN && *w < hpMaxWeight)
+        (*w)++;
+      else if (outcome == NOTTAKEN && *w > -hpMaxWeight)
+        (*w)--;
+    }
+
+    // Adapt the threshold so that mispredictions and low-confidence
+    // updates happen at roughly the same rate
+    if (prediction != outcome)
+    {
+      if (++hpThresholdCounter >= 32)
+      {
+        hpTheta++;
+        hpThresholdCounter = 0;
+      }
+    }
+    else if (--hpThresholdCounter <= -32)
+    {
+      hpTheta--;
+      hpThresholdCounter = 0;
+    }
+  }
+
+  // Update history registers
+  update_hashed_history(pc, outcome);
+  update_hashed_local_history(pc, outcome);
+}
+
+uint64_t hashed_storage_bits()
+{
+  // Only the history and path bits some feature reads are kept
+  uint32_t maxHistory = 0;
+  uint32_t maxPath = 0;
+  for (uint32_t i = 0; i < HP_NUM_FEATURES; i++)
+  {
+    uint32_t end = hpFeatures[i].start + hpFeatures[i].length;
+    if (hpFeatures[i].type == HP_GHIST && end > maxHistory)
+      maxHistory = end;
+    if (hpFeatures[i].type == HP_PATH && end > maxPath)
+      maxPath = end;
+  }
+  uint64_t weights = (uint64_t)HP_NUM_FEATURES * (1 << hashedTableBits) * hashedWeightBits;
+  // Weights, local histories, global and path history, threshold and its
+  // counter, which spans -32 to +32
+  return weights + packed_bits(&hpLocalHistory) + maxHistory + maxPath + 8 + 7;
+}
+
+void cleanup_hashed()
+{
+  free(hpWeights);
+  free(hpIndex);
+  packed_free(&hpLocalHistory);
+}
+
+// YAGS predictor functions
+
+yags_entry yags_get_entry(yags_cache *cache, uint32_t idx)
+{
+  uint64_t raw = packed_get(&cache->entries, idx);
+  yags_entry entry;
+  entry.tag = raw & ((1ULL << yagsTagBits) - 1);
+  entry.ctr = (raw >> yagsTagBits) & 0x3;
+  entry.lru = (raw >> (yagsTagBits + 2)) & ((1 << cache->lruBits) - 1);
+  entry.valid = (raw >> (yagsTagBits + 2 + cache->lruBits)) & 0x1;
+  return entry;
+}
+
+void yags_set_entry(yags_cache *cache, uint32_t idx, yags_entry entry)
+{
+  uint64_t raw = (uint64_t)entry.tag |
+                 ((uint64_t)entry.ctr << yagsTagBits) |
+                 ((uint64_t)entry.lru << (yagsTagBits + 2)) |
+                 ((uint64_t)entry.valid << (yagsTagBits + 2 + cache->lruBits));
+  packed_set(&cache->entries, idx, raw);
+}
+
+void init_yags_cache(yags_cache *cache)
+{
+  cache->lruBits = 0;
+  while ((1 << cache->lruBits) < yagsWays)
+  {
+    cache->lruBits++;
+  }
+  packed_init(&cache->entries, (1 << yagsCacheBits) * yagsWays, yagsTagBits + 3 + cache->lruBits, 0);
+  // Ways of every set start with distinct ranks
+  for (uint32_t set = 0; set < (1u << yagsCacheBits); set++)
+  {
+    for (int way = 0; way < yagsWays; way++)
+    {
+      yags_entry entry = {.tag = 0, .ctr = WN, .lru = (uint8_t)way, .valid = 0};
+      yags_set_entry(cache, set * yagsWays + way, entry);
+    }
+  }
+}
+
+void init_yags()
+{
+  packed_init(&yagsChoice, 1 << yagsChoiceBits, 2, WN);
+  init_yags_cache(&yagsTakenCache);
+  init_yags_cache(&yagsNotTakenCache);
+  yagsHistory = 0;
+}
+
+uint32_t yags_set(uint64_t pc)
+{
+  return index_hash(pc, yagsHistory, yagsCacheBits, yagsCacheBits);
+}
+
+uint32_t yags_tag(uint64_t pc)
+{
+  return pc & ((1 << yagsTagBits) - 1);
+}
+
+// Return the way of 'set' holding 'tag', or -1
+int yags_probe(yags_cache *cache, uint32_t set, uint32_t tag)
+{
+  for (int way = 0; way < yagsWays; way++)
+  {
+    yags_entry entry = yags_get_entry(cache, set * yagsWays + way);
+    if (entry.valid && entry.tag == tag)
+      return way;
+  }
+  return -1;
+}
+
+// Make 'way' the most recently used way of 'set'
+void yags_touch(yags_cache *cache, uint32_t set, int way)
+{
+  uint8_t rank = yags_get_entry(cache, set * yagsWays + way).lru;
+  for (int i = 0; i < yagsWays; i++)
+  {
+    yags_entry entry = yags_get_entry(cache, set * yagsWays + i);
+    if (i == way)
+      entry.lru = 0;
+    else if (entry.lru < rank)
+      entry.lru++;
+    else
+      continue;
+    yags_set_entry(cache, set * yagsWays + i, entry);
+  }
+}
+
+uint8_t yags_predict(uint64_t pc)
+{
+  uint8_t choice = packed_get(&yagsChoice, pc & ((1 << yagsChoiceBits) - 1)) >= WT;
+  // Look for an exception to the bias in the cache of the other direction
+  yags_cache *cache = (choice == TAKEN) ? &yagsNotTakenCache : &yagsTakenCache;
+  uint32_t set = yags_set(pc);
+  int way = yags_probe(cache, set, yags_tag(pc));
+  if (way < 0)
+    return choice;
+  return yags_get_entry(cache, set * yagsWays + way).ctr >= WT;
+}
+
+uint8_t yags_confidence(uint64_t pc)
+{
+  uint8_t choiceCtr = packed_get(&yagsChoice, pc & ((1 << yagsChoiceBits) - 1));
+  yags_cache *cache = (choiceCtr >= WT) ? &yagsNotTakenCache : &yagsTakenCache;
+  uint32_t set = yags_set(pc);
+  int way = yags_probe(cache, set, yags_tag(pc));
+  if (way < 0)
+    return counter_confidence(choiceCtr, 2);
+  return counter_confidence(yags_get_entry(cache, set * yagsWays + way).ctr, 2);
+}
+
+void train_yags(uint64_t pc, uint8_t outcome)
+{
+  uint32_t choiceIndex = pc & ((1 << yagsChoiceBits) - 1);
+  uint8_t choiceCtr = packed_get(&yagsChoice, choiceIndex);
+  uint8_t choice = choiceCtr >= WT;
+  yags_cache *cache = (choice == TAKEN) ? &yagsNotTakenCache : &yagsTakenCache;
+  uint32_t set = yags_set(pc);
+  uint32_t tag = yags_tag(pc);
+  int way = yags_probe(cache, set, tag);
+
+  uint8_t cachePred = choice;
+  if (way >= 0)
+  {
+    // Train the exception entry
+    yags_entry entry = yags_get_entry(cache, set * yagsWays + way);
+    cachePred = entry.ctr >= WT;
+    if (outcome == TAKEN && entry.ctr < ST)
+      entry.ctr++;
+    else if (outcome == NOTTAKEN && entry.ctr > SN)
+      entry.ctr--;
+    yags_set_entry(cache, set * yagsWays + way, entry);
+    yags_touch(cache, set, way);
+  }
+  else if (outcome != choice)
+  {
+    // New exception, replace the least recently used way
+    int victim = 0;
+    for (int i = 0; i < yagsWays; i++)
+    {
+      if (yags_get_entry(cache, set * yagsWays + i).lru == yagsWays - 1)
+        victim = i;
+    }
+    yags_entry entry = yags_get_entry(cache, set * yagsWays + victim);
+    entry.tag = tag;
+    entry.ctr = (outcome == TAKEN) ? WT : WN;
+    entry.valid = 1;
+    yags_set_entry(cache, set * yagsWays + victim, entry);
+    yags_touch(cache, set, victim);
+  }
+
+  // The bias is left alone when a cached exception correctly overrode it
+  if (!(choice != outcome && way >= 0 && cachePred == outcome))
+  {
+    if (outcome == TAKEN && choiceCtr < ST)
+      choiceCtr++;
+    else if (outcome == NOTTAKEN && choiceCtr > SN)
+      choiceCtr--;
+    packed_set(&yagsChoice, choiceIndex, choiceCtr);
+  }
+
+  // Update history register
+  yagsHistory = ((yagsHistory << 1) | outcome);
+}
+
+uint64_t yags_storage_bits()
+{
+  return packed_bits(&yagsChoice) + packed_bits(&yagsTakenCache.entries) +
+         packed_bits(&yagsNotTakenCache.entries) + yagsCacheBits;
+}
+
+void cleanup_yags()
+{
+  packed_free(&yagsChoice);
+  packed_free(&yagsTakenCache.entries);
+  packed_free(&yagsNotTakenCache.entries);
+}
+
+// Loop override functions
+
+void init_loop_override()
+{
+  init_loop(&overrideLoop, loopLogSets, loopWays);
+  loopOverrides = 0;
+  loopOverridesCorrect = 0;
+}
+
+// Replace 'prediction' with the loop prediction when the loop predictor
+// is confident and has proven more accurate than the predictor it wraps
+uint8_t loop_override_predict(uint64_t pc, uint8_t prediction)
+{
+  uint8_t loopValid;
+  uint8_t loopPred = loop_predict(&overrideLoop, pc, &loopValid);
+  return (loopValid && overrideLoop.withLoop >= 0) ? loopPred : prediction;
+}
+
+// Must run before the wrapped predictor is trained, while 'basePred'
+// still matches what it predicted
+void train_loop_override(uint64_t pc, uint8_t outcome, uint8_t basePred)
+{
+  uint8_t loopValid;
+  uint8_t loopPred = loop_predict(&overrideLoop, pc, &loopValid);
+  uint8_t prediction = (loopValid && overrideLoop.withLoop >= 0) ? loopPred : basePred;
+
+  if (prediction != basePred)
+  {
+    loopOverrides++;
+    if (prediction == outcome)
+      loopOverridesCorrect++;
+  }
+  if (loopValid)
+  {
+    train_loop_usefulness(&overrideLoop, loopPred, basePred, outcome);
+  }
+  train_loop(&overrideLoop, pc, outcome, prediction != outcome);
+}
+
+// Branch target buffer functions
+
+btb_entry btb_get_entry(uint32_t idx)
+{
+  uint64_t raw = packed_get(&btb, idx);
+  btb_entry entry;
+  entry.tag = raw & ((1ULL << btbTagBits) - 1);
+  entry.target = (raw >> btbTagBits) & ((1ULL << BTB_TARGET_BITS) - 1);
+  entry.rank = (raw >> (btbTagBits + BTB_TARGET_BITS)) & ((1 << btbRankBits) - 1);
+  entry.valid = (raw >> (btbTagBits + BTB_TARGET_BITS + btbRankBits)) & 0x1;
+  return entry;
+}
+
+void btb_set_entry(uint32_t idx, btb_entry entry)
+{
+  uint64_t raw = (uint64_t)entry.tag |
+                 ((uint64_t)entry.target << btbTagBits) |
+                 ((uint64_t)entry.rank << (btbTagBits + BTB_TARGET_BITS)) |
+                 ((uint64_t)entry.valid << (btbTagBits + BTB_TARGET_BITS + btbRankBits));
+  packed_set(&btb, idx, raw);
+}
+
+void init_btb()
+{
+  btbRankBits = 0;
+  while (btbPolicy != BTB_RANDOM && (1 << btbRankBits) < btbWays)
+  {
+    btbRankBits++;
+  }
+  packed_init(&btb, (1 << btbLogSets) * btbWays, btbTagBits + BTB_TARGET_BITS + btbRankBits + 1, 0);
+  // Ways of every set start with distinct ranks
+  for (uint32_t set = 0; set < (1u << btbLogSets); set++)
+  {
+    for (int way = 0; way < btbWays; way++)
+    {
+      btb_entry entry = {.tag = 0, .target = 0, .rank = (uint8_t)(btbRankBits ? way : 0), .valid = 0};
+      btb_set_entry(set * btbWays + way, entry);
+    }
+  }
+  btbSeed = 0;
+  btbLookups = 0;
+  btbHits = 0;
+  btbTargetMisses = 0;
+}
+
+uint32_t btb_set(uint64_t pc)
+{
+  return pc & ((1 << btbLogSets) - 1);
+}
+
+uint32_t btb_tag(uint64_t pc)
+{
+  return (pc >> btbLogSets) & ((1 << btbTagBits) - 1);
+}
+
+// Return the way of the set of 'pc' holding its tag, or -1
+int btb_probe(uint64_t pc)
+{
+  uint32_t set = btb_set(pc);
+  uint32_t tag = btb_tag(pc);
+  for (int way = 0; way < btbWays; way++)
+  {
+    btb_entry entry = btb_get_entry(set * btbWays + way);
+    if (entry.valid && entry.tag == tag)
+      return way;
+  }
+  return -1;
+}
+
+// Give 'way' rank 0 and age the ways ranked before it
+void btb_touch(uint32_t set, int way)
+{
+  uint8_t rank = btb_get_entry(set * btbWays + way).rank;
+  for (int i = 0; i < btbWays; i++)
+  {
+    btb_entry entry = btb_get_entry(set * btbWays + i);
+    if (i == way)
+      entry.rank = 0;
+    else if (entry.rank < rank)
+      entry.rank++;
+    else
+      continue;
+    btb_set_entry(set * btbWays + i, entry);
+  }
+}
+
+int btb_victim(uint32_t set)
+{
+  for (int i = 0; i < btbWays; i++)
+  {
+    if (!btb_get_entry(set * btbWays + i).valid)
+      return i;
+  }
+  if (btbPolicy == BTB_RANDOM)
+  {
+    btbSeed = btbSeed * 1103515245 + 12345;
+    return (btbSeed >> 16) % btbWays;
+  }
+  // Both LRU and FIFO evict the highest rank; they differ in when ranks move
+  int victim = 0;
+  for (int i = 0; i < btbWays; i++)
+  {
+    if (btb_get_entry(set * btbWays + i).rank == btbWays - 1)
+      victim = i;
+  }
+  return victim;
+}
+
+// Predicted target of the branch at 'pc', or 0 on a BTB miss
+uint64_t btb_predict(uint64_t pc)
+{
+  int way = btb_probe(pc);
+  if (way < 0)
+    return 0;
+  return region_target(pc, btb_get_entry(btb_set(pc) * btbWays + way).target);
+}
+
+// Score the lookup made for this branch, then update the BTB. Only taken
+// branches are allocated, as a not-taken branch needs no target.
+// 'rasVerdict' is the return address stack's score for a return whose
+// target it supplied instead of the BTB, or -1
+void train_btb(uint64_t pc, uint64_t target, uint8_t outcome, int rasVerdict)
+{
+  uint32_t set = btb_set(pc);
+  int way = btb_probe(pc);
+
+  btbLookups++;
+  if (way >= 0)
+    btbHits++;
+  if (rasVerdict >= 0)
+  {
+    if (!rasVerdict)
+      btbTargetMisses++;
+  }
+  else if (outcome == TAKEN && (way < 0 || region_target(pc, btb_get_entry(set * btbWays + way).target) != target))
+  {
+    btbTargetMisses++;
+  }
+
+  if (outcome != TAKEN)
+    return;
+
+  if (way >= 0)
+  {
+    btb_entry entry = btb_get_entry(set * btbWays + way);
+    entry.target = target;
+    btb_set_entry(set * btbWays + way, entry);
+    if (btbPolicy == BTB_LRU)
+      btb_touch(set, way);
+  }
+  else
+  {
+    int victim = btb_victim(set);
+    btb_entry entry = btb_get_entry(set * btbWays + victim);
+    entry.tag = btb_tag(pc);
+    entry.target = target;
+    entry.valid = 1;
+    btb_set_entry(set * btbWays + victim, entry);
+    if (btbPolicy != BTB_RANDOM)
+      btb_touch(set, victim);
+  }
+}
+
+uint64_t btb_storage_bits()
+{
+  return packed_bits(&btb);
+}
+
+void cleanup_btb()
+{
+  packed_free(&btb);
+}
+
+// Return address stack functions
+
+void init_ras()
+{
+  rasStack = (uint64_t *)calloc(rasDepth, sizeof(uint64_t));
+  rasTop = 0;
+  rasCount = 0;
+  rasDropped = 0;
+  rasReturns = 0;
+  rasPredicted = 0;
+  rasCorrect = 0;
+  rasOverflows = 0;
+  rasUnderflows = 0;
+}
+
+void ras_push(uint64_t pc)
+{
+  if (rasCount == (uint32_t)rasDepth)
+  {
+    rasOverflows++;
+    if (rasOverflow == RAS_DROP)
+    {
+      rasDropped++;
+      return;
+    }
+    // Overwrite the oldest entry
+    rasCount--;
+  }
+  rasStack[rasTop] = pc;
+  rasTop = (rasTop + 1) % rasDepth;
+  rasCount++;
+}
+
+// Pop the call PC a return goes back to. Returns 0 when the stack has no
+// prediction: the matching call was dropped, or the stack is empty and
+// the underflow policy is RAS_EMPTY
+uint8_t ras_pop(uint64_t *callPc)
+{
+  if (rasDropped > 0)
+  {
+    rasDropped--;
+    return 0;
+  }
+  if (rasCount == 0)
+  {
+    rasUnderflows++;
+    if (rasUnderflow == RAS_EMPTY)
+      return 0;
+    // Pop a stale entry regardless
+    rasTop = (rasTop + rasDepth - 1) % rasDepth;
+    *callPc = rasStack[rasTop];
+    return 1;
+  }
+  rasTop = (rasTop + rasDepth - 1) % rasDepth;
+  rasCount--;
+  *callPc = rasStack[rasTop];
+  return 1;
+}
+
+// Update the stack with a branch and score it if it is a return. Returns
+// whether the stack predicted the return correctly, or -1 when it made no
+// prediction
+int train_ras(uint64_t pc, uint64_t target, uint32_t call, uint32_t ret)
+{
+  int verdict = -1;
+  if (ret)
+  {
+    uint64_t callPc;
+    rasReturns++;
+    if (ras_pop(&callPc))
+    {
+      rasPredicted++;
+      verdict = (target > callPc && target - callPc <= RAS_MAX_CALL_LENGTH);
+      rasCorrect += verdict;
+    }
+  }
+  if (call)
+  {
+    ras_push(pc);
+  }
+  return verdict;
+}
+
+uint64_t ras_storage_bits()
+{
+  uint32_t pointerBits = 0;
+  while ((1 << pointerBits) < rasDepth)
+  {
+    pointerBits++;
+  }
+  return (uint64_t)rasDepth * RAS_ADDRESS_BITS + 2 * pointerBits;
+}
+
+void cleanup_ras()
+{
+  free(rasStack);
+}
+
+// ITTAGE functions
+
+ittage_entry ittage_get_entry(ittage_table *table, uint32_t idx)
+{
+  uint64_t raw = packed_get(&table->entries, idx);
+  ittage_entry entry;
+  entry.tag = raw & ((1ULL << table->numTagBits) - 1);
+  entry.target = (raw >> table->numTagBits) & ((1ULL << ITTAGE_TARGET_BITS) - 1);
+  entry.ctr = (raw >> (table->numTagBits + ITTAGE_TARGET_BITS)) & 0x3;
+  entry.useful = (raw >> (table->numTagBits + ITTAGE_TARGET_BITS + 2)) & 0x1;
+  return entry;
+}
+
+void ittage_set_entry(ittage_table *table, uint32_t idx, ittage_entry entry)
+{
+  uint64_t raw = (uint64_t)(entry.tag & ((1ULL << table->numTagBits) - 1)) |
+                 ((uint64_t)entry.target << table->numTagBits) |
+                 ((uint64_t)(entry.ctr & 0x3) << (table->numTagBits + ITTAGE_TARGET_BITS)) |
+                 ((uint64_t)(entry.useful & 0x1) << (table->numTagBits + ITTAGE_TARGET_BITS + 2));
+  packed_set(&table->entries, idx, raw);
+}
+
+void init_ittage()
+{
+  packed_init(&ittageBase, 1 << ITTAGE_BASE_BITS, ITTAGE_TARGET_BITS, 0);
+  for (int i = 0; i < ITTAGE_NUM_TABLES; i++)
+  {
+    ittage_table *table = &ittageTables[i];
+    // Tags start at 0 with an empty target, so nothing matches usefully
+    packed_init(&table->entries, 1 << table->logSize, table->numTagBits + ITTAGE_TARGET_BITS + 3, 0);
+    folded_init(&table->indexFold, table->historyBits, table->logSize);
+    folded_init(&table->tagFold[0], table->historyBits, table->numTagBits);
+    folded_init(&table->tagFold[1], table->historyBits, table->numTagBits - 1);
+  }
+  memset(ittageHistory, 0, sizeof(ittageHistory));
+  ittageHistoryPtr = 0;
+  ittageTick = 0;
+  ittageLookups = 0;
+  ittageCorrect = 0;
+  ittageBaseCorrect = 0;
+}
+
+uint32_t ittage_index(uint64_t pc, ittage_table *table)
+{
+  return (pc ^ (pc >> table->logSize) ^ table->indexFold.comp) & ((1 << table->logSize) - 1);
+}
+
+uint32_t ittage_tag(uint64_t pc, ittage_table *table)
+{
+  uint32_t tag = pc ^ table->tagFold[0].comp ^ (table->tagFold[1].comp << 1);
+  return tag & ((1 << table->numTagBits) - 1);
+}
+
+void ittage_lookup(uint64_t pc, ittage_prediction *p)
+{
+  p->provider = -1;
+  p->alt = -1;
+  p->baseIndex = pc & ((1 << ITTAGE_BASE_BITS) - 1);
+  p->baseTarget = packed_get(&ittageBase, p->baseIndex);
+
+  // Longest match provides, next longest is the alternate
+  ittage_entry providerEntry = {0, 0, 0, 0};
+  p->altTarget = p->baseTarget;
+  for (int i = ITTAGE_NUM_TABLES - 1; i >= 0; i--)
+  {
+    p->index[i] = ittage_index(pc, &ittageTables[i]);
+    p->tag[i] = ittage_tag(pc, &ittageTables[i]);
+    if (p->alt >= 0)
+      continue;
+    ittage_entry entry = ittage_get_entry(&ittageTables[i], p->index[i]);
+    if (entry.tag != p->tag[i])
+      continue;
+    if (p->provider < 0)
+    {
+      p->provider = i;
+      providerEntry = entry;
+    }
+    else
+    {
+      p->alt = i;
+      p->altTarget = entry.target;
+    }
+  }
+
+  if (p->provider < 0)
+  {
+    p->target = p->baseTarget;
+    return;
+  }
+  p->providerTarget = providerEntry.target;
+  // A provider with no confidence yet defers to the alternate
+  p->target = (providerEntry.ctr == 0) ? p->altTarget : p->providerTarget;
+}
+
+// Allocate an entry in a table with longer history than the provider
+void ittage_allocate(ittage_prediction *p, uint64_t target)
+{
+  int start = p->provider + 1;
+  for (int i = start; i < ITTAGE_NUM_TABLES; i++)
+  {
+    ittage_entry entry = ittage_get_entry(&ittageTables[i], p->index[i]);
+    if (!entry.useful)
+    {
+      entry.tag = p->tag[i];
+      entry.target = target;
+      entry.ctr = 0;
+      ittage_set_entry(&ittageTables[i], p->index[i], entry);
+      return;
+    }
+  }
+
+  // Every candidate is useful, make room for later allocations
+  for (int i = start; i < ITTAGE_NUM_TABLES; i++)
+  {
+    ittage_entry entry = ittage_get_entry(&ittageTables[i], p->index[i]);
+    entry.useful = 0;
+    ittage_set_entry(&ittageTables[i], p->index[i], entry);
+  }
+}
+
+void ittage_reset_useful()
+{
+  for (int i = 0; i < ITTAGE_NUM_TABLES; i++)
+  {
+    for (uint32_t idx = 0; idx < (1u << ittageTables[i].logSize); idx++)
+    {
+      ittage_entry entry = ittage_get_entry(&ittageTables[i], idx);
+      if (entry.useful)
+      {
+        entry.useful = 0;
+        ittage_set_entry(&ittageTables[i], idx, entry);
+      }
+    }
+  }
+}
+
+void update_ittage_history(uint8_t bit)
+{
+  ittageHistoryPtr = (ittageHistoryPtr - 1) & (TAGE_HIST_BUFFER - 1);
+  ittageHistory[ittageHistoryPtr] = bit;
+  for (int i = 0; i < ITTAGE_NUM_TABLES; i++)
+  {
+    folded_update(&ittageTables[i].indexFold, ittageHistory, ittageHistoryPtr);
+    folded_update(&ittageTables[i].tagFold[0], ittageHistory, ittageHistoryPtr);
+    folded_update(&ittageTables[i].tagFold[1], ittageHistory, ittageHistoryPtr);
+  }
+}
+
+// Predict, score and train an indirect branch
+void train_ittage_target(uint64_t pc, uint64_t target)
+{
+  ittage_prediction p;
+  ittage_lookup(pc, &p);
+
+  ittageLookups++;
+  ittageCorrect += (region_target(pc, p.target) == target);
+  ittageBaseCorrect += (region_target(pc, p.baseTarget) == target);
+
+  if (p.provider >= 0)
+  {
+    ittage_table *provider = &ittageTables[p.provider];
+    ittage_entry entry = ittage_get_entry(provider, p.index[p.provider]);
+    if (region_target(pc, p.providerTarget) == target)
+    {
+      if (entry.ctr < ITTAGE_CTR_MAX)
+        entry.ctr++;
+      if (region_target(pc, p.altTarget) != target)
+        entry.useful = 1;
+    }
+    else if (entry.ctr > 0)
+    {
+      entry.ctr--;
+    }
+    else
+    {
+      entry.target = target;
+    }
+    ittage_set_entry(provider, p.index[p.provider], entry);
+  }
+  packed_set(&ittageBase, p.baseIndex, target);
+
+  if (region_target(pc, p.target) != target)
+  {
+    ittage_allocate(&p, target);
+  }
+
+  if (++ittageTick >= ITTAGE_USEFUL_RESET_PERIOD)
+  {
+    ittage_reset_useful();
+    ittageTick = 0;
+  }
+}
+
+// Conditional branches shift in their outcome and indirect branches two
+// bits of their target; other branches carry no information
+void train_ittage(uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t direct)
+{
+  if (!direct)
+  {
+    train_ittage_target(pc, target);
+    update_ittage_history((target ^ (target >> 4)) & 1);
+    update_ittage_history(((target >> 1) ^ (target >> 5)) & 1);
+  }
+  else if (condition)
+  {
+    update_ittage_history(outcome);
+  }
+}
+
+uint64_t ittage_storage_bits()
+{
+  uint64_t bits = packed_bits(&ittageBase);
+  for (int i = 0; i < ITTAGE_NUM_TABLES; i++)
+  {
+    bits += packed_bits(&ittageTables[i].entries);
+  }
+  // Global history and useful reset tick
+  return bits + ittageTables[ITTAGE_NUM_TABLES - 1].historyBits + 16;
+}
+
+void cleanup_ittage()
+{
+  packed_free(&ittageBase);
+  for (int i = 0; i < ITTAGE_NUM_TABLES; i++)
+  {
+    packed_free(&ittageTables[i].entries);
+  }
+}
+
+// Delayed update functions
+
+void register_history(void *base, size_t bytes)
+{
+  historyRegions[numHistoryRegions].base = base;
+  historyRegions[numHistoryRegions].bytes = bytes;
+  numHistoryRegions++;
+  historyBytes += bytes;
+}
+
+void history_save(uint8_t *checkpoint)
+{
+  for (int i = 0; i < numHistoryRegions; i++)
+  {
+    memcpy(checkpoint, historyRegions[i].base, historyRegions[i].bytes);
+    checkpoint += historyRegions[i].bytes;
+  }
+}
+
+void history_restore(const uint8_t *checkpoint)
+{
+  for (int i = 0; i < numHistoryRegions; i++)
+  {
+    memcpy(historyRegions[i].base, checkpoint, historyRegions[i].bytes);
+    checkpoint += historyRegions[i].bytes;
+  }
+}
+
+// Describe the history state of the selected predictor. Tables and
+// training state such as thresholds and loop counters are not history:
+// they only change when the delayed update is applied
+void init_delayed_update()
+{
+  numHistoryRegions = 0;
+  historyBytes = 0;
+  register_history(&pathHistory, sizeof(pathHistory));
+  switch (bpType)
+  {
+  case GSHARE:
+    register_history(&ghistory, sizeof(ghistory));
+    break;
+  case TOURNAMENT:
+    register_history(tournamentLocal.histories, sizeof(tournamentLocal.histories));
+    register_history(tournamentGlobal.histories, sizeof(tournamentGlobal.histories));
+    break;
+  case CUSTOM:
+    // The folded histories live in the table descriptors
+    register_history(tageHistory, sizeof(tageHistory));
+    register_history(&tageHistoryPtr, sizeof(tageHistoryPtr));
+    register_history(&tagePath, sizeof(tagePath));
+    register_history(tageTables, sizeof(tageTables));
+    register_history(scTables, sizeof(scTables));
+    break;
+  case PERCEPTRON:
+    register_history(perceptronInputs, perceptronStride);
+    break;
+  case HASHED:
+    register_history(hpHistory, sizeof(hpHistory));
+    register_history(&hpPath, sizeof(hpPath));
+    register_history(hpLocalHistory.words, PACKED_WORDS(HP_LOCAL_ENTRIES, HP_LOCAL_BITS) * sizeof(uint64_t));
+    break;
+  case YAGS:
+    register_history(&yagsHistory, sizeof(yagsHistory));
+    break;
+  case BIMODE:
+    register_history(&bimodeHistory, sizeof(bimodeHistory));
+    break;
+  case GSKEW:
+    register_history(&gskewHistory, sizeof(gskewHistory));
+    break;
+  case TWOLEVEL:
+    switch (twoLevelScheme)
+    {
+    case TWOLEVEL_GAG: register_history(twoLevelGAg.histories, sizeof(twoLevelGAg.histories)); break;
+    case TWOLEVEL_GAP: register_history(twoLevelGAp.histories, sizeof(twoLevelGAp.histories)); break;
+    case TWOLEVEL_PAG: register_history(twoLevelPAg.histories, sizeof(twoLevelPAg.histories)); break;
+    case TWOLEVEL_PAP: register_history(twoLevelPAp.histories, sizeof(twoLevelPAp.histories)); break;
+    case TWOLEVEL_SAG: register_history(twoLevelSAg.histories, sizeof(twoLevelSAg.histories)); break;
+    case TWOLEVEL_SAS: register_history(twoLevelSAs.histories, sizeof(twoLevelSAs.histories)); break;
+    default: break;
+    }
+    break;
+  default:
+    break;
+  }
+
+  delayedUpdates = (delayed_update *)calloc(updateDelay + 1, sizeof(delayed_update));
+  for (int i = 0; i <= updateDelay; i++)
+  {
+    delayedUpdates[i].checkpoint = (uint8_t *)malloc(historyBytes);
+  }
+  historyScratch = (uint8_t *)malloc(historyBytes);
+  delayedHead = 0;
+  delayedCount = 0;
+  historyRepairs = 0;
+}
+
+void cleanup_delayed_update()
+{
+  for (int i = 0; i <= updateDelay; i++)
+  {
+    free(delayedUpdates[i].checkpoint);
+  }
+  free(delayedUpdates);
+  free(historyScratch);
+}
+
+void init_predictor()
+{
+  pathHistory = 0;
+  switch (bpType)
+  {
+  case STATIC:
+    break;
+  case GSHARE:
+    init_gshare();
+    break;
+  case TOURNAMENT:
+    init_tournament();
+    break;
+  case CUSTOM:
+    init_custom();
+    break;
+  case PERCEPTRON:
+    init_perceptron();
+    break;
+  case HASHED:
+    init_hashed();
+    break;
+  case YAGS:
+    init_yags();
+    break;
+  case BIMODE:
+    init_bimode();
+    break;
+  case GSKEW:
+    init_gskew();
+    break;
+  case TWOLEVEL:
+    init_twolevel();
+    break;
+  default:
+    break;
+  }
+
+  if (loopOverride)
+  {
+    init_loop_override();
+  }
+  if (btbEnabled)
+  {
+    init_btb();
+  }
+  if (rasEnabled)
+  {
+    init_ras();
+  }
+  if (ittageEnabled)
+  {
+    init_ittage();
+  }
+  if (updateDelay > 0)
+  {
+    init_delayed_update();
+  }
+}
+
+// Make a prediction for conditional branch instruction at PC 'pc'
+// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
+// indicates a prediction of not taken
+//
+// Prediction of the selected predictor alone
+//
+uint8_t base_prediction(uint64_t pc)
+{
+  // Make a prediction based on the bpType
+  switch (bpType)
+  {
+  case STATIC:
+    return TAKEN;
+  case GSHARE:
+    return gshare_predict(pc);
+  case TOURNAMENT:
+    return tournament_predict(pc);
+  case CUSTOM:
+    return custom_predict(pc);
+  case PERCEPTRON:
+    return perceptron_predict(pc);
+  case HASHED:
+    return hashed_predict(pc);
+  case YAGS:
+    return yags_predict(pc);
+  case BIMODE:
+    return bimode_predict(pc);
+  case GSKEW:
+    return gskew_predict(pc);
+  case TWOLEVEL:
+    return twolevel_predict(pc);
+  default:
+    break;
   }
 
   // If there is not a compatable bpType then return NOTTAKEN
   return NOTTAKEN;
 }
 
-// Train the predictor the last executed branch at PC 'pc' and with
-// outcome 'outcome' (true indicates that the branch was taken, false
-// indicates that the branch was not taken)
+uint32_t make_prediction(uint64_t pc, uint64_t target, uint32_t direct)
+{
+  uint8_t prediction = base_prediction(pc);
+  if (loopOverride)
+  {
+    prediction = loop_override_predict(pc, prediction);
+  }
+  return prediction;
+}
+
+// Confidence of the selected predictor alone
+//
+uint8_t base_confidence(uint64_t pc)
+{
+  switch (bpType)
+  {
+  case STATIC:
+    return CONF_LOW;
+  case GSHARE:
+    return gshare_confidence(pc);
+  case TOURNAMENT:
+    return tournament_confidence(pc);
+  case CUSTOM:
+    return custom_confidence(pc);
+  case PERCEPTRON:
+    return perceptron_confidence(pc);
+  case HASHED:
+    return hashed_confidence(pc);
+  case YAGS:
+    return yags_confidence(pc);
+  case BIMODE:
+    return bimode_confidence(pc);
+  case GSKEW:
+    return gskew_confidence(pc);
+  case TWOLEVEL:
+    return twolevel_confidence(pc);
+  default:
+    break;
+  }
+  return CONF_LOW;
+}
+
+// Confidence level of the prediction make_prediction returns for the
+// conditional branch at PC 'pc', to be called before training
+//
+uint8_t prediction_confidence(uint64_t pc)
+{
+  if (loopOverride)
+  {
+    uint8_t loopValid;
+    loop_predict(&overrideLoop, pc, &loopValid);
+    if (loopValid && overrideLoop.withLoop >= 0)
+      return CONF_HIGH;
+  }
+  return base_confidence(pc);
+}
+
+// Shift an unconditional branch into the global history of the selected
+// predictor. Local histories are left alone. Direct jumps and calls always
+// go the same way so they shift in a taken bit; returns and indirect
+// branches shift in a target bit, which tells apart the call sites being
+// returned to
+//
+void update_uncond_history(uint64_t pc, uint64_t target, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (uncondHistory == UNCOND_NONE || (uncondHistory == UNCOND_CALLRET && !call && !ret))
+  {
+    return;
+  }
+  uint8_t bit = (direct && !ret) ? TAKEN : ((target ^ (target >> 4)) & 1);
+
+  switch (bpType)
+  {
+  case GSHARE:
+    ghistory = (ghistory << 1) | bit;
+    break;
+  case TOURNAMENT:
+    tournamentGlobal.update_global_history(bit);
+    break;
+  case CUSTOM:
+    update_tage_history(pc, bit);
+    break;
+  case PERCEPTRON:
+    update_perceptron_history(bit);
+    break;
+  case HASHED:
+    update_hashed_history(pc, bit);
+    break;
+  case YAGS:
+    yagsHistory = (yagsHistory << 1) | bit;
+    break;
+  case BIMODE:
+    bimodeHistory = (bimodeHistory << 1) | bit;
+    break;
+  case GSKEW:
+    gskewHistory = (gskewHistory << 1) | bit;
+    break;
+  case TWOLEVEL:
+    switch (twoLevelScheme)
+    {
+    case TWOLEVEL_GAG: twoLevelGAg.update_global_history(bit); break;
+    case TWOLEVEL_GAP: twoLevelGAp.update_global_history(bit); break;
+    default: break;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Train the loop predictors with a conditional branch. They count the
+// iterations of the loop in flight, so in delayed update mode they are
+// trained when the branch is fetched rather than with the tables
 //
+void train_loops(uint64_t pc, uint8_t outcome)
+{
+  if (loopOverride)
+  {
+    train_loop_override(pc, outcome, base_prediction(pc));
+  }
+  if (bpType == CUSTOM)
+  {
+    train_custom_loop(pc, outcome);
+  }
+}
 
-void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+// Train the direction predictor and its histories with one branch
+//
+void train_direction(uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
 {
   if (condition)
   {
+    if (updateDelay == 0)
+    {
+      train_loops(pc, outcome);
+    }
     switch (bpType)
     {
     case STATIC:
-      return;
+      break;
     case GSHARE:
-      return train_gshare(pc, outcome);
+      train_gshare(pc, outcome);
+      break;
     case TOURNAMENT:
-      return train_tournament(pc, outcome);
+      train_tournament(pc, outcome);
+      break;
     case CUSTOM:
-    return train_custom(pc, outcome);
-      return;
+      train_custom(pc, outcome);
+      break;
+    case PERCEPTRON:
+      train_perceptron(pc, outcome);
+      break;
+    case HASHED:
+      train_hashed(pc, outcome);
+      break;
+    case YAGS:
+      train_yags(pc, outcome);
+      break;
+    case BIMODE:
+      train_bimode(pc, outcome);
+      break;
+    case GSKEW:
+      train_gskew(pc, outcome);
+      break;
+    case TWOLEVEL:
+      train_twolevel(pc, outcome);
+      break;
     default:
       break;
     }
   }
+  else
+  {
+    update_uncond_history(pc, target, call, ret, direct);
+  }
+
+  if (outcome == TAKEN)
+  {
+    update_path_history(pc, target);
+  }
+}
+
+// Shift a conditional branch into the histories of the selected predictor
+// without training its tables
+void update_spec_history(uint64_t pc, uint8_t outcome)
+{
+  switch (bpType)
+  {
+  case GSHARE:
+    ghistory = (ghistory << 1) | outcome;
+    break;
+  case TOURNAMENT:
+    tournamentLocal.update_history(pc, outcome);
+    tournamentGlobal.update_history(pc, outcome);
+    break;
+  case CUSTOM:
+    update_tage_history(pc, outcome);
+    break;
+  case PERCEPTRON:
+    update_perceptron_history(outcome);
+    break;
+  case HASHED:
+    update_hashed_history(pc, outcome);
+    update_hashed_local_history(pc, outcome);
+    break;
+  case YAGS:
+    yagsHistory = (yagsHistory << 1) | outcome;
+    break;
+  case BIMODE:
+    bimodeHistory = (bimodeHistory << 1) | outcome;
+    break;
+  case GSKEW:
+    gskewHistory = (gskewHistory << 1) | outcome;
+    break;
+  case TWOLEVEL:
+    switch (twoLevelScheme)
+    {
+    case TWOLEVEL_GAG: twoLevelGAg.update_history(pc, outcome); break;
+    case TWOLEVEL_GAP: twoLevelGAp.update_history(pc, outcome); break;
+    case TWOLEVEL_PAG: twoLevelPAg.update_history(pc, outcome); break;
+    case TWOLEVEL_PAP: twoLevelPAp.update_history(pc, outcome); break;
+    case TWOLEVEL_SAG: twoLevelSAg.update_history(pc, outcome); break;
+    case TWOLEVEL_SAS: twoLevelSAs.update_history(pc, outcome); break;
+    default: break;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Update the histories speculatively with the branch being fetched and
+// queue it; once updateDelay younger branches have been fetched, train
+// the tables with it against the histories it was predicted with
+void train_delayed(uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  delayed_update *update = &delayedUpdates[(delayedHead + delayedCount) % (updateDelay + 1)];
+  update->pc = pc;
+  update->target = target;
+  update->outcome = outcome;
+  update->condition = condition;
+  update->call = call;
+  update->ret = ret;
+  update->direct = direct;
+  history_save(update->checkpoint);
+  delayedCount++;
+
+  if (condition)
+  {
+    // The trace holds no wrong path, so a misprediction is repaired
+    // before the next branch is fetched
+    uint8_t prediction = make_prediction(pc, target, direct);
+    train_loops(pc, outcome);
+    update_spec_history(pc, prediction);
+    if (prediction != outcome)
+    {
+      history_restore(update->checkpoint);
+      update_spec_history(pc, outcome);
+      historyRepairs++;
+    }
+  }
+  else
+  {
+    update_uncond_history(pc, target, call, ret, direct);
+  }
+  if (outcome == TAKEN)
+  {
+    update_path_history(pc, target);
+  }
+
+  if (delayedCount > (uint32_t)updateDelay)
+  {
+    delayed_update *oldest = &delayedUpdates[delayedHead];
+    history_save(historyScratch);
+    history_restore(oldest->checkpoint);
+    train_direction(oldest->pc, oldest->target, oldest->outcome, oldest->condition,
+                    oldest->call, oldest->ret, oldest->direct);
+    history_restore(historyScratch);
+    delayedHead = (delayedHead + 1) % (updateDelay + 1);
+    delayedCount--;
+  }
+}
+
+// Train the predictor the last executed branch at PC 'pc' and with
+// outcome 'outcome' (true indicates that the branch was taken, false
+// indicates that the branch was not taken)
+//
+void train_predictor(uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (updateDelay > 0)
+  {
+    train_delayed(pc, target, outcome, condition, call, ret, direct);
+  }
+  else
+  {
+    train_direction(pc, target, outcome, condition, call, ret, direct);
+  }
+
+  // The front-end models are trained at fetch in both modes
+  int rasVerdict = -1;
+  if (rasEnabled)
+  {
+    rasVerdict = train_ras(pc, target, call, ret);
+  }
+  if (btbEnabled)
+  {
+    train_btb(pc, target, outcome, rasVerdict);
+  }
+  if (ittageEnabled)
+  {
+    train_ittage(pc, target, outcome, condition, direct);
+  }
+}
+
+// Return the number of bits of modelled hardware storage used by the
+// predictor (tables and history registers)
+//
+uint64_t predictor_storage_bits()
+{
+  uint64_t bits = 0;
+  switch (bpType)
+  {
+  case STATIC:
+    break;
+  case GSHARE:
+    bits = gshare_storage_bits();
+    break;
+  case TOURNAMENT:
+    bits = tournament_storage_bits();
+    break;
+  case CUSTOM:
+    bits = custom_storage_bits();
+    break;
+  case PERCEPTRON:
+    bits = perceptron_storage_bits();
+    break;
+  case HASHED:
+    bits = hashed_storage_bits();
+    break;
+  case YAGS:
+    bits = yags_storage_bits();
+    break;
+  case BIMODE:
+    bits = bimode_storage_bits();
+    break;
+  case GSKEW:
+    bits = gskew_storage_bits();
+    break;
+  case TWOLEVEL:
+    bits = twolevel_storage_bits();
+    break;
+  default:
+    break;
+  }
+  if (loopOverride)
+  {
+    bits += loop_storage_bits(&overrideLoop);
+  }
+  return bits;
 }
@@ -85,17 +85,148 @@ void init_predictor();
 // Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
 // indicates a prediction of not taken
 //
-uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct);
+uint32_t make_prediction(uint64_t pc, uint64_t target, uint32_t direct);
 
 // Train the predictor the last executed branch at PC 'pc' and with
 // outcome 'outcome' (true indicates that the branch was taken, false
 // indicates that the branch was not taken)
 //
-void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+void train_predictor(uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
 
 // Please add your code below, and DO NOT MODIFY ANY OF THE CODE ABOVE
 // 
 
+// Additional Predictor Types
+#define PERCEPTRON 4
+#define HASHED 5
+#define YAGS 6
+#define BIMODE 7
+#define GSKEW 8
+#define TWOLEVEL 9
+
+// The Confidence Levels
+#define CONF_LOW 0
+#define CONF_MEDIUM 1
+#define CONF_HIGH 2
+extern const char *confidenceName[];
+
+// The Index Hash Functions
+#define HASH_XOR 0  // PC xor history
+#define HASH_FOLD 1 // PC xor history folded to the index width
+#define HASH_PATH 2 // PC xor history xor folded path history
+extern const char *indexHashName[];
+
+// The Unconditional History Modes
+#define UNCOND_NONE 0    // Only conditional branches enter global history
+#define UNCOND_ALL 1     // Jumps, calls and returns enter global history too
+#define UNCOND_CALLRET 2 // Calls and returns enter global history, jumps do not
+extern const char *uncondHistoryName[];
+
+// The BTB Replacement Policies
+#define BTB_LRU 0
+#define BTB_FIFO 1
+#define BTB_RANDOM 2
+extern const char *btbPolicyName[];
+
+// The Return Address Stack Overflow and Underflow Policies
+#define RAS_WRAP 0  // Overwrite the oldest entry / pop a stale entry
+#define RAS_DROP 1  // Overflow: drop the call, its return gets no prediction
+#define RAS_EMPTY 1 // Underflow: make no prediction
+extern const char *rasOverflowName[];
+extern const char *rasUnderflowName[];
+
+// The Two-Level Schemes
+#define TWOLEVEL_GAG 0
+#define TWOLEVEL_GAP 1
+#define TWOLEVEL_PAG 2
+#define TWOLEVEL_PAP 3
+#define TWOLEVEL_SAG 4
+#define TWOLEVEL_SAS 5
+extern const char *twoLevelName[];
+
+// Additional Predictor Configuration
+extern int perceptronHistoryBits; // Global history length of the perceptron
+extern int perceptronWeightBits;  // Width of a perceptron weight (2 to 8 bits)
+extern int perceptronEntries;     // Number of perceptron weight vectors
+extern int hashedTableBits;       // log2 of the entries in each hashed perceptron table
+extern int hashedWeightBits;      // Width of a hashed perceptron weight (2 to 8 bits)
+extern int bimodeTableBits;       // log2 of the entries in each bi-mode table
+extern int bimodeHistoryBits;     // Global history length of bi-mode
+extern int gskewBankBits;         // log2 of the entries in each 2bc-gskew bank
+extern int gskewHistoryBits;      // Global history length of 2bc-gskew
+extern int indexHash;             // Hash of PC and history used by gshare, bi-mode and YAGS
+extern int uncondHistory;         // Which unconditional branches update global history
+extern int twoLevelScheme;        // Yeh-Patt scheme of the two-level predictor
+extern int yagsChoiceBits;        // log2 of the YAGS choice PHT entries
+extern int yagsCacheBits;         // log2 of the sets in each YAGS direction cache
+extern int yagsWays;              // YAGS direction cache associativity
+extern int yagsTagBits;           // YAGS direction cache tag width
+extern int loopOverride;          // Let a loop predictor override the selected predictor
+extern int loopLogSets;           // log2 of the loop predictor sets
+extern int loopWays;              // Loop predictor associativity
+extern int btbEnabled;            // Model a branch target buffer fed by every branch
+extern int btbLogSets;            // log2 of the BTB sets
+extern int btbWays;               // BTB associativity
+extern int btbTagBits;            // BTB tag width
+extern int btbPolicy;             // BTB replacement policy
+extern int rasEnabled;            // Model a return address stack driven by calls and returns
+extern int rasDepth;              // Return address stack entries
+extern int rasOverflow;           // What a call does to a full return address stack
+extern int rasUnderflow;          // What a return does to an empty return address stack
+extern int ittageEnabled;         // Model an ITTAGE indirect target predictor
+extern int updateDelay;           // Branches between a prediction and its table update
+
+// Hashed target and PC bits of recent taken branches, including
+// unconditional ones, available to every predictor
+extern uint64_t pathHistory;
+
+// Loop override statistics
+extern uint64_t loopOverrides;        // Predictions changed by the loop predictor
+extern uint64_t loopOverridesCorrect; // ... of which were correct
+
+// BTB statistics
+extern uint64_t btbLookups;      // Branches looked up in the BTB
+extern uint64_t btbHits;         // ... that found an entry
+extern uint64_t btbTargetMisses; // Taken branches whose target the BTB did not supply
+
+// Return address stack statistics
+extern uint64_t rasReturns;    // Returns seen
+extern uint64_t rasPredicted;  // ... for which the stack gave a prediction
+extern uint64_t rasCorrect;    // ... that was correct
+extern uint64_t rasOverflows;  // Calls made with the stack full
+extern uint64_t rasUnderflows; // Returns made with the stack empty
+
+// Delayed update statistics
+extern uint64_t historyRepairs; // Mispredictions repaired from a checkpoint
+
+// Indirect target predictor statistics
+extern uint64_t ittageLookups;     // Indirect branches predicted
+extern uint64_t ittageCorrect;     // ... whose target ITTAGE predicted
+extern uint64_t ittageBaseCorrect; // ... whose target the base table alone predicted
+
+// Return the confidence level (CONF_LOW to CONF_HIGH) of the prediction
+// for the conditional branch at PC 'pc'; call before train_predictor
+//
+uint8_t prediction_confidence(uint64_t pc);
+
+// Return the number of bits of modelled hardware storage used by the
+// selected predictor
+//
+uint64_t predictor_storage_bits();
+
+// Return the number of bits of storage used by the BTB
+//
+uint64_t btb_storage_bits();
+
+// Return the number of bits of storage used by the return address stack
+//
+uint64_t ras_storage_bits();
+
+// Return the number of bits of storage used by the indirect target
+// predictor
+//
+uint64_t ittage_storage_bits();
+
 
 
 #endif
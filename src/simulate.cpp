@@ -0,0 +1,478 @@
+//========================================================//
+//  simulate.cpp                                          //
+//  Source file for running the Branch Predictor on a     //
+//  stream of branches                                    //
+//                                                        //
+//  Handles the predictor options, counts mispredictions  //
+//  and prints the statistics, for the trace simulator    //
+//  and for branchExtractor's online evaluation           //
+//========================================================//
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "predictor.h"
+#include "simulate.h"
+
+const char *sampleKindName[] = {"warmup", "measure", "end"};
+
+static int confidence = 0;
+static uint64_t intervalLength = 0;
+
+// Sampled traces: only the measured part of each sample is counted, the
+// rest of the trace just trains the predictor. Each sample is weighted by
+// the instructions it stands for; the totals cover the samples of every
+// stream
+static uint32_t numSamples = 0;
+static uint64_t sampledInstructions = 0;
+static double weightedBranches = 0;
+static double weightedMispredictions = 0;
+static double weightedInstructions = 0;
+
+// Statistics of the branches counted so far
+static uint32_t num_branches = 0;
+static uint32_t mispredictions = 0;
+static uint32_t conf_branches[CONF_HIGH + 1] = {0};
+static uint32_t conf_mispredictions[CONF_HIGH + 1] = {0};
+
+// Instruction counts, when the branches come with them
+static uint64_t num_instructions = 0;
+static uint64_t all_branches = 0;
+static uint64_t taken_branches = 0;
+static uint64_t interval_instructions = 0;
+static uint32_t interval_mispredictions = 0;
+static uint32_t num_intervals = 0;
+
+// Print out the predictor options to stderr
+//
+void options_usage()
+{
+  fprintf(stderr, " --verbose    Print predictions on stdout\n");
+  fprintf(stderr, " --confidence Report mispredictions per confidence level\n");
+  fprintf(stderr, " --interval:<instructions>\n"
+                  "              Print the MPKI of every interval of that many\n"
+                  "              instructions (traces with instruction counts)\n");
+  fprintf(stderr, " --loop[:<log2 sets>:<ways>]\n"
+                  "              Let a loop predictor override the scheme\n");
+  fprintf(stderr, " --hash:<xor|fold|path>\n"
+                  "              Index hash of gshare, bimode and yags\n");
+  fprintf(stderr, " --uncond:<none|all|callret>\n"
+                  "              Unconditional branches entering global history\n");
+  fprintf(stderr, " --btb[:<log2 sets>:<ways>:<tag bits>[:lru|fifo|random]]\n"
+                  "              Model a branch target buffer\n");
+  fprintf(stderr, " --ras[:<depth>[:wrap|drop[:wrap|empty]]]\n"
+                  "              Model a return address stack, with its overflow\n"
+                  "              and underflow policies\n");
+  fprintf(stderr, " --ittage     Model an ITTAGE indirect target predictor\n");
+  fprintf(stderr, " --delay:<branches>\n"
+                  "              Train the tables that many branches late, with\n"
+                  "              speculative history repaired on mispredictions\n");
+  fprintf(stderr, " --<type>     Branch prediction scheme:\n");
+  fprintf(stderr, "    static\n"
+                  "    gshare\n"
+                  "    tournament\n"
+                  "    custom\n"
+                  "    perceptron[:<history bits>:<weight bits>:<entries>]\n"
+                  "    hashed[:<log2 table entries>:<weight bits>]\n"
+                  "    yags[:<log2 choice entries>:<log2 cache sets>:<ways>:<tag bits>]\n"
+                  "    bimode[:<log2 table entries>:<history bits>]\n"
+                  "    gskew[:<log2 bank entries>:<history bits>]\n"
+                  "    twolevel[:GAg|GAp|PAg|PAp|SAg|SAs]\n");
+}
+
+// Process an option and update the predictor
+// configuration variables accordingly
+//
+// Returns True if Successful
+//
+int handle_option(char *arg)
+{
+  if (!strcmp(arg, "--static"))
+  {
+    bpType = STATIC;
+  }
+  else if (!strncmp(arg, "--gshare", 8))
+  {
+    bpType = GSHARE;
+  }
+  else if (!strncmp(arg, "--tournament", 12))
+  {
+    bpType = TOURNAMENT;
+  }
+  else if (!strncmp(arg, "--custom", 8))
+  {
+    bpType = CUSTOM;
+  }
+  else if (!strncmp(arg, "--perceptron", 12))
+  {
+    bpType = PERCEPTRON;
+    if (arg[12] == ':')
+    {
+      sscanf(arg + 13, "%d:%d:%d", &perceptronHistoryBits, &perceptronWeightBits, &perceptronEntries);
+    }
+    if (perceptronHistoryBits < 1 || perceptronWeightBits < 2 || perceptronWeightBits > 8 || perceptronEntries < 1)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--hashed", 8))
+  {
+    bpType = HASHED;
+    if (arg[8] == ':')
+    {
+      sscanf(arg + 9, "%d:%d", &hashedTableBits, &hashedWeightBits);
+    }
+    if (hashedTableBits < 1 || hashedTableBits > 20 || hashedWeightBits < 2 || hashedWeightBits > 8)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--yags", 6))
+  {
+    bpType = YAGS;
+    if (arg[6] == ':')
+    {
+      sscanf(arg + 7, "%d:%d:%d:%d", &yagsChoiceBits, &yagsCacheBits, &yagsWays, &yagsTagBits);
+    }
+    if (yagsChoiceBits < 1 || yagsChoiceBits > 24 || yagsCacheBits < 1 || yagsCacheBits > 20 ||
+        yagsWays < 1 || yagsWays > 16 || yagsTagBits < 1 || yagsTagBits > 32)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--bimode", 8))
+  {
+    bpType = BIMODE;
+    if (arg[8] == ':')
+    {
+      sscanf(arg + 9, "%d:%d", &bimodeTableBits, &bimodeHistoryBits);
+    }
+    if (bimodeTableBits < 1 || bimodeTableBits > 24 || bimodeHistoryBits < 0 || bimodeHistoryBits > 64)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--gskew", 7))
+  {
+    bpType = GSKEW;
+    if (arg[7] == ':')
+    {
+      sscanf(arg + 8, "%d:%d", &gskewBankBits, &gskewHistoryBits);
+    }
+    if (gskewBankBits < 2 || gskewBankBits > 24 || gskewHistoryBits < 0 || gskewHistoryBits > 64)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--twolevel", 10))
+  {
+    bpType = TWOLEVEL;
+    if (arg[10] == ':')
+    {
+      int found = 0;
+      for (int i = TWOLEVEL_GAG; i <= TWOLEVEL_SAS; i++)
+      {
+        if (!strcmp(arg + 11, twoLevelName[i]))
+        {
+          twoLevelScheme = i;
+          found = 1;
+        }
+      }
+      if (!found)
+      {
+        return 0;
+      }
+    }
+  }
+  else if (!strncmp(arg, "--loop", 6))
+  {
+    loopOverride = 1;
+    if (arg[6] == ':')
+    {
+      sscanf(arg + 7, "%d:%d", &loopLogSets, &loopWays);
+    }
+    if (loopLogSets < 0 || loopLogSets > 16 || loopWays < 1)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--hash:", 7))
+  {
+    int found = 0;
+    for (int i = HASH_XOR; i <= HASH_PATH; i++)
+    {
+      if (!strcmp(arg + 7, indexHashName[i]))
+      {
+        indexHash = i;
+        found = 1;
+      }
+    }
+    if (!found)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--uncond:", 9))
+  {
+    int found = 0;
+    for (int i = UNCOND_NONE; i <= UNCOND_CALLRET; i++)
+    {
+      if (!strcmp(arg + 9, uncondHistoryName[i]))
+      {
+        uncondHistory = i;
+        found = 1;
+      }
+    }
+    if (!found)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--btb", 5))
+  {
+    btbEnabled = 1;
+    if (arg[5] == ':')
+    {
+      char policy[16] = "";
+      if (sscanf(arg + 6, "%d:%d:%d:%15s", &btbLogSets, &btbWays, &btbTagBits, policy) == 4)
+      {
+        btbPolicy = -1;
+        for (int i = BTB_LRU; i <= BTB_RANDOM; i++)
+        {
+          if (!strcmp(policy, btbPolicyName[i]))
+          {
+            btbPolicy = i;
+          }
+        }
+      }
+    }
+    if (btbLogSets < 0 || btbLogSets > 20 || btbWays < 1 || btbWays > 64 ||
+        btbTagBits < 0 || btbTagBits > 24 || btbPolicy < 0)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--ras", 5))
+  {
+    rasEnabled = 1;
+    if (arg[5] == ':')
+    {
+      char overflow[16] = "wrap";
+      char underflow[16] = "wrap";
+      sscanf(arg + 6, "%d:%15[a-z]:%15[a-z]", &rasDepth, overflow, underflow);
+      rasOverflow = -1;
+      rasUnderflow = -1;
+      for (int i = RAS_WRAP; i <= RAS_DROP; i++)
+      {
+        if (!strcmp(overflow, rasOverflowName[i]))
+          rasOverflow = i;
+        if (!strcmp(underflow, rasUnderflowName[i]))
+          rasUnderflow = i;
+      }
+    }
+    if (rasDepth < 1 || rasOverflow < 0 || rasUnderflow < 0)
+    {
+      return 0;
+    }
+  }
+  else if (!strncmp(arg, "--delay:", 8))
+  {
+    if (sscanf(arg + 8, "%d", &updateDelay) != 1 || updateDelay < 0)
+    {
+      return 0;
+    }
+  }
+  else if (!strcmp(arg, "--ittage"))
+  {
+    ittageEnabled = 1;
+  }
+  else if (!strncmp(arg, "--interval:", 11))
+  {
+    if (sscanf(arg + 11, "%" SCNu64, &intervalLength) != 1 || intervalLength == 0)
+    {
+      return 0;
+    }
+  }
+  else if (!strcmp(arg, "--confidence"))
+  {
+    confidence = 1;
+  }
+  else if (!strcmp(arg, "--verbose"))
+  {
+    verbose = 1;
+  }
+  else
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+// Start a stream that is measured until its first sample boundary
+//
+void init_sample_state(SampleState *state)
+{
+  memset(state, 0, sizeof(*state));
+  state->measuring = 1;
+}
+
+// Starts or ends the warmup or measured part of a sample of the stream
+// 'state' at instruction count 'count'
+//
+void sample_boundary(SampleState *state, uint32_t kind, uint64_t count, uint64_t weight)
+{
+  if (kind == SAMPLE_WARMUP)
+  {
+    state->measuring = 0;
+    state->weight = weight;
+  }
+  else if (kind == SAMPLE_MEASURE)
+  {
+    state->measuring = 1;
+    state->measureStart = count;
+    state->branches = 0;
+    state->mispredictions = 0;
+  }
+  else if (kind == SAMPLE_END && state->measuring && count > state->measureStart)
+  {
+    // Scale the sample up to the instructions it stands for
+    double scale = (double)state->weight / (double)(count - state->measureStart);
+    numSamples++;
+    sampledInstructions += count - state->measureStart;
+    weightedBranches += scale * state->branches;
+    weightedMispredictions += scale * state->mispredictions;
+    weightedInstructions += state->weight;
+    state->measuring = 0;
+  }
+  else
+  {
+    state->measuring = 0;
+  }
+}
+
+// Predict and train the predictor on a branch of the stream 'state',
+// counting it unless it is in the warmup part of a sample
+//
+void simulate_branch(SampleState *state, uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct, uint64_t instructions)
+{
+  if (state->measuring)
+  {
+    num_instructions += instructions;
+    interval_instructions += instructions;
+    all_branches++;
+    taken_branches += outcome;
+  }
+  if (condition == 1)
+  {
+    // Make a prediction and compare with actual outcome
+    uint32_t prediction = make_prediction(pc, target, direct);
+    if (state->measuring)
+    {
+      num_branches++;
+      state->branches++;
+      if (prediction != outcome)
+      {
+        mispredictions++;
+        state->mispredictions++;
+        interval_mispredictions++;
+      }
+      if (confidence)
+      {
+        uint8_t level = prediction_confidence(pc);
+        conf_branches[level]++;
+        conf_mispredictions[level] += (prediction != outcome);
+      }
+      if (verbose != 0)
+      {
+        printf("%d\n", prediction);
+      }
+    }
+  }
+  // Train the predictor
+  train_predictor(pc, target, outcome, condition, call, ret, direct);
+
+  if (intervalLength > 0 && interval_instructions >= intervalLength)
+  {
+    printf("Interval %6u MPKI:  %7.3f\n", num_intervals++,
+           1000 * ((float)interval_mispredictions / (float)interval_instructions));
+    interval_instructions = 0;
+    interval_mispredictions = 0;
+  }
+}
+
+// Print out the statistics of the branches simulated so far
+//
+void print_statistics()
+{
+  // Print out the mispredict statistics
+  printf("Branches:        %10d\n", num_branches);
+  printf("Incorrect:       %10d\n", mispredictions);
+  float mispredict_rate = 1000 * ((float)mispredictions / (float)num_branches);
+  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  printf("Storage (bits):  %10llu\n", (unsigned long long)predictor_storage_bits());
+  if (num_instructions > 0)
+  {
+    // Instructions per branch is the basic block length, per taken branch
+    // the length of a fetch block
+    printf("Instructions:    %10llu\n", (unsigned long long)num_instructions);
+    printf("MPKI:               %7.3f\n", 1000 * ((float)mispredictions / (float)num_instructions));
+    printf("Block length:       %7.3f\n", (float)num_instructions / (float)all_branches);
+    printf("Fetch block length: %7.3f\n", taken_branches ? (float)num_instructions / (float)taken_branches : 0.0f);
+  }
+  if (numSamples > 0)
+  {
+    printf("Samples:         %10u\n", numSamples);
+    printf("Sampled instrs:  %10llu\n", (unsigned long long)sampledInstructions);
+    printf("Weighted Rate:      %7.3f\n", 1000 * (weightedMispredictions / weightedBranches));
+    printf("Weighted MPKI:      %7.3f\n", 1000 * (weightedMispredictions / weightedInstructions));
+  }
+  if (loopOverride)
+  {
+    printf("Loop overrides:  %10llu\n", (unsigned long long)loopOverrides);
+    printf("Loop correct:    %10llu\n", (unsigned long long)loopOverridesCorrect);
+    printf("Override Rate:      %7.3f\n", 1000 * ((float)loopOverrides / (float)num_branches));
+  }
+  if (updateDelay > 0)
+  {
+    printf("History repairs: %10llu\n", (unsigned long long)historyRepairs);
+  }
+  if (confidence)
+  {
+    for (int i = CONF_LOW; i <= CONF_HIGH; i++)
+    {
+      printf("%-6s branches: %10d\n", confidenceName[i], conf_branches[i]);
+      printf("%-6s incorrect:%10d\n", confidenceName[i], conf_mispredictions[i]);
+      printf("%-6s Rate:        %7.3f\n", confidenceName[i],
+             conf_branches[i] ? 1000 * ((float)conf_mispredictions[i] / (float)conf_branches[i]) : 0.0f);
+    }
+  }
+  if (btbEnabled)
+  {
+    printf("BTB lookups:     %10llu\n", (unsigned long long)btbLookups);
+    printf("BTB hits:        %10llu\n", (unsigned long long)btbHits);
+    printf("BTB Hit Rate:       %7.3f\n", 100 * ((float)btbHits / (float)btbLookups));
+    printf("Target misses:   %10llu\n", (unsigned long long)btbTargetMisses);
+    printf("Target Miss Rate:   %7.3f\n", 1000 * ((float)btbTargetMisses / (float)btbLookups));
+    printf("BTB bits:        %10llu\n", (unsigned long long)btb_storage_bits());
+  }
+  if (rasEnabled)
+  {
+    printf("Returns:         %10llu\n", (unsigned long long)rasReturns);
+    printf("RAS predicted:   %10llu\n", (unsigned long long)rasPredicted);
+    printf("RAS correct:     %10llu\n", (unsigned long long)rasCorrect);
+    printf("RAS Accuracy:       %7.3f\n", 100 * ((float)rasCorrect / (float)rasReturns));
+    printf("RAS overflows:   %10llu\n", (unsigned long long)rasOverflows);
+    printf("RAS underflows:  %10llu\n", (unsigned long long)rasUnderflows);
+    printf("RAS bits:        %10llu\n", (unsigned long long)ras_storage_bits());
+  }
+  if (ittageEnabled)
+  {
+    printf("Indirect:        %10llu\n", (unsigned long long)ittageLookups);
+    printf("Base correct:    %10llu\n", (unsigned long long)ittageBaseCorrect);
+    printf("Base Accuracy:      %7.3f\n", 100 * ((float)ittageBaseCorrect / (float)ittageLookups));
+    printf("ITTAGE correct:  %10llu\n", (unsigned long long)ittageCorrect);
+    printf("ITTAGE Accuracy:    %7.3f\n", 100 * ((float)ittageCorrect / (float)ittageLookups));
+    printf("ITTAGE bits:     %10llu\n", (unsigned long long)ittage_storage_bits());
+  }
+}
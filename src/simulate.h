@@ -0,0 +1,63 @@
+//========================================================//
+//  simulate.h                                            //
+//  Header file for running the Branch Predictor on a     //
+//  stream of branches                                    //
+//                                                        //
+//  Shared by the trace simulator and branchExtractor's   //
+//  online evaluation                                     //
+//========================================================//
+
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include <stdint.h>
+
+// The Sample Boundary Kinds
+#define SAMPLE_WARMUP 0
+#define SAMPLE_MEASURE 1
+#define SAMPLE_END 2
+extern const char *sampleKindName[];
+
+// Where a stream of branches is in its samples. The trace simulator has a
+// single stream, branchExtractor's online evaluation one per thread
+typedef struct
+{
+  int measuring;          // Branches are counted
+  uint64_t measureStart;  // Instruction count at the start of the measured part
+  uint64_t weight;        // Instructions the current sample stands for
+  uint32_t branches;      // Conditional branches measured in the current sample
+  uint32_t mispredictions;
+} SampleState;
+
+// Print out the predictor options to stderr
+//
+void options_usage();
+
+// Process an option and update the predictor
+// configuration variables accordingly
+//
+// Returns True if Successful
+//
+int handle_option(char *arg);
+
+// Start a stream that is measured until its first sample boundary
+//
+void init_sample_state(SampleState *state);
+
+// Starts or ends the warmup or measured part of a sample of the stream
+// 'state' at instruction count 'count'; 'weight' is the number of
+// instructions a sample starting there stands for
+//
+void sample_boundary(SampleState *state, uint32_t kind, uint64_t count, uint64_t weight);
+
+// Predict and train the predictor on a branch of the stream 'state',
+// counting it unless it is in the warmup part of a sample; 'instructions'
+// are those executed since the previous branch, 0 when unknown
+//
+void simulate_branch(SampleState *state, uint64_t pc, uint64_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct, uint64_t instructions);
+
+// Print out the statistics of the branches simulated so far
+//
+void print_statistics();
+
+#endif